@@ -0,0 +1,32 @@
+//-------------------------------------------------------------------------------------------
+//
+// Page-aligned I/O buffers, as required by O_DIRECT. Sizes are rounded up to a
+// whole number of pages.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef ALIGNED_BUFFER_H
+#define ALIGNED_BUFFER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <unistd.h>
+
+struct AlignedFree {
+	void operator()(uint8_t* p) const { std::free(p); }
+};
+
+typedef std::unique_ptr<uint8_t[], AlignedFree> AlignedBuffer;
+
+inline AlignedBuffer make_aligned_buffer(size_t n) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	void* p = std::aligned_alloc(page, (n + page - 1) / page * page);
+	if(p == nullptr)
+		throw std::bad_alloc();
+
+	return AlignedBuffer((uint8_t*)p);
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "async_writer.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------
+//
+// The caller owns one buffer at a time (the first one it submits is its own),
+// so n_buffers - 1 extra buffers are allocated here
+//
+AsyncWriter::AsyncWriter(function<void(const uint8_t*, size_t)> write, int n_buffers, size_t buffer_size) :
+  m_write { std::move(write) } {
+	for(int i = 1 ; i < n_buffers ; ++i) {
+		m_buffers.push_back(make_aligned_buffer(buffer_size));
+		m_free.push_back(m_buffers.back().get());
+	}
+
+	m_thread = thread(&AsyncWriter::run, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+	finish();
+}
+
+//---------------------------------------------------------------------------------
+//
+// I/O thread: writes the queued buffers in order and returns them to the free list
+//
+void AsyncWriter::run() {
+	unique_lock<mutex> lock(m_mutex);
+	while(true) {
+		m_cv.wait(lock, [this] { return m_done or not m_queue.empty(); });
+		if(m_queue.empty())
+			return;
+
+		auto [buf, n] = m_queue.front();
+		lock.unlock();
+		m_write(buf, n);
+		lock.lock();
+
+		m_queue.pop_front();
+		m_free.push_back(buf);
+		m_cv.notify_all();
+	}
+}
+
+//---------------------------------------------------------------------------------
+//
+// Queues the first n bytes of buf for writing and returns a free buffer,
+// waiting for the I/O thread if there is none
+//
+uint8_t* AsyncWriter::submit(uint8_t* buf, size_t n) {
+	unique_lock<mutex> lock(m_mutex);
+	m_queue.emplace_back(buf, n);
+	m_submits++;
+	m_cv.notify_all();
+
+	if(m_free.empty()) {
+		m_waits++;
+		m_cv.wait(lock, [this] { return not m_free.empty(); });
+	}
+
+	uint8_t* next = m_free.back();
+	m_free.pop_back();
+
+	return next;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Waits for all queued buffers to be written and stops the I/O thread
+//
+void AsyncWriter::finish() {
+	if(not m_thread.joinable())
+		return;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_done = true;
+	}
+
+	m_cv.notify_all();
+	m_thread.join();
+}
+
@@ -0,0 +1,53 @@
+//-------------------------------------------------------------------------------------------
+//
+// Background writer for ByteStream. Full buffers are queued to an I/O thread
+// that writes them out (through ByteStream's file or descriptor), while the
+// caller keeps filling a free one.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "aligned_buffer.h"
+
+class AsyncWriter {
+  private:
+	std::function<void(const uint8_t*, size_t)>	m_write;
+	std::vector<AlignedBuffer>					m_buffers;
+	std::vector<uint8_t*>						m_free;		// Buffers ready to be filled
+	std::deque<std::pair<uint8_t*, size_t>>		m_queue;	// Buffers waiting to be written
+	std::mutex									m_mutex;
+	std::condition_variable						m_cv;
+	std::thread									m_thread;
+	bool										m_done { false };
+	uint64_t									m_submits { };
+	uint64_t									m_waits { };
+
+	void run();
+
+  public:
+	AsyncWriter(std::function<void(const uint8_t*, size_t)> write, int n_buffers, size_t buffer_size);
+	~AsyncWriter();
+
+	AsyncWriter() = delete;
+	AsyncWriter(const AsyncWriter&) = delete;
+	AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+	uint8_t* submit(uint8_t* buf, size_t n);
+	void finish();
+	uint64_t submits() const { return m_submits; }
+	uint64_t waits() const { return m_waits; }
+};
+
+#endif
+
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include "bit_stream.h"
+#include "byte_stream.h"
+
+using namespace std;
+
+// Microbenchmarks for the BitStream and ByteStream primitives, on file-backed
+// (fstream) and in-memory (vector/span) streams, with random and constant data.
+// Every line reports the payload throughput (MB/s) and the cost per field (ns).
+//
+// Usage: bench_bitstream [fields per run] [temporary file]
+
+size_t numFields = 1 << 22;
+string tmpFile = "bench_bitstream.tmp";
+uint64_t sink = 0; // Keeps the reads from being optimized away
+
+double timeIt(const function<void()>& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string& op, int width, bool randomData, bool inMemory, double fields, double seconds) {
+    cout << left << setw(14) << op << right << setw(6) << width
+         << setw(10) << (randomData ? "random" : "constant")
+         << setw(8) << (inMemory ? "memory" : "file")
+         << setw(12) << fields * width / 8 / seconds / 1e6
+         << setw(10) << seconds * 1e9 / fields << "\n";
+}
+
+// Runs a write pass, then (optionally) a read pass over what was written
+void runBitStream(const function<void(BitStream&)>& writer, const function<void(BitStream&)>& reader,
+                  bool inMemory, double& writeTime, double& readTime) {
+    vector<uint8_t> mem;
+    if (inMemory) {
+        BitStream bs(mem);
+        writeTime = timeIt([&] { writer(bs); bs.close(); });
+    } else {
+        fstream fs(tmpFile, ios::out | ios::binary);
+        BitStream bs(fs, STREAM_WRITE);
+        writeTime = timeIt([&] { writer(bs); bs.close(); });
+    }
+
+    readTime = 0;
+    if (!reader) return;
+
+    if (inMemory) {
+        BitStream bs(span<const uint8_t>(mem.data(), mem.size()));
+        readTime = timeIt([&] { reader(bs); });
+    } else {
+        fstream fs(tmpFile, ios::in | ios::binary);
+        BitStream bs(fs, STREAM_READ);
+        readTime = timeIt([&] { reader(bs); });
+        bs.close();
+    }
+}
+
+void benchFields(bool randomData, bool inMemory) {
+    mt19937_64 rng(1);
+    vector<uint64_t> values(numFields);
+
+    for (int width = 1; width <= 64; width++) {
+        uint64_t mask = width == 64 ? ~uint64_t { } : (uint64_t { 1 } << width) - 1;
+        for (auto& v : values) v = (randomData ? rng() : 0x5555555555555555) & mask;
+
+        double writeTime, readTime;
+        runBitStream([&](BitStream& bs) { for (uint64_t v : values) bs.write_n_bits(v, width); },
+                     [&](BitStream& bs) {
+                         uint64_t errors = 0;
+                         for (uint64_t v : values) errors += bs.read_n_bits(width) != v;
+                         if (errors) {
+                             cerr << "Error: read_n_bits mismatch at width " << width << "\n";
+                             exit(1);
+                         }
+                     },
+                     inMemory, writeTime, readTime);
+
+        report("write_n_bits", width, randomData, inMemory, numFields, writeTime);
+        report("read_n_bits", width, randomData, inMemory, numFields, readTime);
+    }
+}
+
+void benchBits(bool randomData, bool inMemory) {
+    mt19937_64 rng(2);
+    vector<uint8_t> bits(numFields);
+    for (auto& b : bits) b = randomData ? rng() & 1 : 1;
+
+    double writeTime, readTime;
+    runBitStream([&](BitStream& bs) { for (int b : bits) bs.write_bit(b); },
+                 [&](BitStream& bs) { for (size_t i = 0; i < numFields; i++) sink += bs.read_bit(); },
+                 inMemory, writeTime, readTime);
+
+    report("write_bit", 1, randomData, inMemory, numFields, writeTime);
+    report("read_bit", 1, randomData, inMemory, numFields, readTime);
+}
+
+void benchStrings(bool randomData, bool inMemory) {
+    mt19937_64 rng(3);
+    const size_t length = 32;
+    vector<string> strings(numFields / length);
+    for (auto& s : strings) {
+        s.resize(length);
+        for (auto& c : s) c = randomData ? 'a' + rng() % 26 : 'x';
+    }
+
+    double writeTime, readTime;
+    runBitStream([&](BitStream& bs) { for (const auto& s : strings) bs.write_string(s); },
+                 [&](BitStream& bs) { for (size_t i = 0; i < strings.size(); i++) sink += bs.read_string().size(); },
+                 inMemory, writeTime, readTime);
+
+    // Reported per character (including the terminating newline)
+    report("write_string", 8, randomData, inMemory, strings.size() * (length + 1), writeTime);
+    report("read_string", 8, randomData, inMemory, strings.size() * (length + 1), readTime);
+}
+
+void benchBytes(bool randomData, bool inMemory) {
+    mt19937_64 rng(4);
+    vector<uint8_t> bytes(numFields);
+    for (auto& b : bytes) b = randomData ? rng() : 0xa5;
+
+    vector<uint8_t> mem;
+    double writeTime, readTime;
+    if (inMemory) {
+        ByteStream bs(mem);
+        writeTime = timeIt([&] { for (int b : bytes) bs.put(b); bs.close(); });
+    } else {
+        fstream fs(tmpFile, ios::out | ios::binary);
+        ByteStream bs(fs, STREAM_WRITE);
+        writeTime = timeIt([&] { for (int b : bytes) bs.put(b); bs.close(); });
+    }
+
+    if (inMemory) {
+        ByteStream bs(span<const uint8_t>(mem.data(), mem.size()));
+        readTime = timeIt([&] { for (size_t i = 0; i < numFields; i++) sink += bs.get(); });
+    } else {
+        fstream fs(tmpFile, ios::in | ios::binary);
+        ByteStream bs(fs, STREAM_READ);
+        readTime = timeIt([&] { for (size_t i = 0; i < numFields; i++) sink += bs.get(); });
+        bs.close();
+    }
+
+    report("ByteStream put", 8, randomData, inMemory, numFields, writeTime);
+    report("ByteStream get", 8, randomData, inMemory, numFields, readTime);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) numFields = atol(argv[1]);
+    if (argc > 2) tmpFile = argv[2];
+
+    if (numFields < 64) {
+        cerr << "Usage: " << argv[0] << " [fields per run (>= 64, default: 4194304)] [temporary file]\n";
+        return 1;
+    }
+
+    cout << "Fields per run: " << numFields << "\n";
+    cout << left << setw(14) << "operation" << right << setw(6) << "width" << setw(10) << "data"
+         << setw(8) << "stream" << setw(12) << "MB/s" << setw(10) << "ns/field" << "\n";
+    cout << fixed << setprecision(2);
+
+    for (bool inMemory : { false, true }) {
+        for (bool randomData : { true, false }) {
+            benchBits(randomData, inMemory);
+            benchFields(randomData, inMemory);
+            benchStrings(randomData, inMemory);
+            benchBytes(randomData, inMemory);
+        }
+    }
+
+    remove(tmpFile.c_str());
+    cerr << "(checksum " << sink << ")\n";
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include "bit_stream.h"
+#include "packed_codec.h"
+
+using namespace std;
+
+// Throughput of the fixed-width packing paths, for every width from 1 to 16:
+//   loop   - one write_n_bits/read_n_bits call per value
+//   packed - BitStream::write_packed/read_packed (runtime width, SIMD grouping)
+//   codec  - PackedCodec<Bits> selected through packed_codec(bits)
+
+constexpr size_t NUM_VALUES = 1 << 22;
+constexpr size_t CHUNK = 65536; // Values per call, as in wav_quant_enc
+
+double timeIt(const function<void()>& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double writeRate(const string& file, const vector<uint16_t>& values, int bits, int method) {
+    fstream fs(file, ios::out | ios::binary);
+    BitStream bs(fs, STREAM_WRITE);
+    const PackedCodecOps& codec = packed_codec(bits);
+
+    double t = timeIt([&] {
+        for (size_t i = 0; i < values.size(); i += CHUNK) {
+            span<const uint16_t> chunk(values.data() + i, CHUNK);
+            if (method == 0) {
+                for (uint16_t v : chunk) bs.write_n_bits(v, bits);
+            } else if (method == 1) {
+                bs.write_packed(chunk, bits);
+            } else {
+                codec.pack(bs, chunk);
+            }
+        }
+        bs.close();
+    });
+
+    return values.size() / t / 1e6;
+}
+
+double readRate(const string& file, vector<uint16_t>& values, int bits, int method) {
+    fstream fs(file, ios::in | ios::binary);
+    BitStream bs(fs, STREAM_READ);
+    const PackedCodecOps& codec = packed_codec(bits);
+
+    double t = timeIt([&] {
+        for (size_t i = 0; i < values.size(); i += CHUNK) {
+            span<uint16_t> chunk(values.data() + i, CHUNK);
+            if (method == 0) {
+                for (uint16_t& v : chunk) v = bs.read_n_bits(bits);
+            } else if (method == 1) {
+                bs.read_packed(chunk, bits);
+            } else {
+                codec.unpack(bs, chunk);
+            }
+        }
+    });
+    bs.close();
+
+    return values.size() / t / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    string file = argc > 1 ? argv[1] : "bench_packed_codec.tmp";
+
+    mt19937 rng(1);
+    vector<uint16_t> values(NUM_VALUES), decoded(NUM_VALUES);
+
+    cout << "Msamples/s (" << NUM_VALUES << " values per run)\n";
+    cout << "bits   write:loop  packed   codec    read:loop  packed   codec\n";
+    cout << fixed << setprecision(1);
+
+    for (int bits = 1; bits <= 16; bits++) {
+        for (auto& v : values) v = rng() & ((1u << bits) - 1);
+
+        cout << setw(4) << bits << "  ";
+        for (int method = 0; method < 3; method++)
+            cout << setw(10) << writeRate(file, values, bits, method);
+        cout << " ";
+        for (int method = 0; method < 3; method++) {
+            cout << setw(10) << readRate(file, decoded, bits, method);
+            if (decoded != values) {
+                cerr << "\nError: decoded values differ at " << bits << " bits\n";
+                return 1;
+            }
+        }
+        cout << "\n";
+    }
+
+    remove(file.c_str());
+
+    return 0;
+}
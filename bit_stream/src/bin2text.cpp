@@ -18,10 +18,30 @@
 //
 #include <iostream>
 #include <fstream>
+#include <array>
+#include <cstring>
+#include <vector>
 #include "bit_stream.h"
 
 using namespace std;
 
+const size_t BLOCK_SIZE = 1 << 17; // Bytes converted at a time
+
+//------------------------------------------------------------------------------
+//
+// The eight characters for every byte value, most significant bit first
+//
+constexpr array<array<char, 8>, 256> make_text_table() {
+	array<array<char, 8>, 256> table { };
+	for(int b = 0 ; b < 256 ; ++b)
+		for(int i = 0 ; i < 8 ; ++i)
+			table[b][i] = (b >> (7 - i)) & 1 ? '1' : '0';
+
+	return table;
+}
+
+constexpr array<array<char, 8>, 256> TEXT = make_text_table();
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char* argv[]) {
@@ -45,16 +65,14 @@ int main(int argc, char* argv[]) {
 
 	BitStream ibs { ifs, STREAM_READ };
 
-	int c;
-	while((c = ibs.read_bit()) != EOF) {
-		switch(c) {
-			case 0:
-				ofs << "0";
-				break;
-			case 1:
-				ofs << "1";
-				break;
-		}
+	vector<uint8_t> bytes(BLOCK_SIZE);
+	vector<char> text(8 * BLOCK_SIZE);
+	size_t n;
+	while((n = ibs.read_bytes(bytes)) > 0) {
+		for(size_t i = 0 ; i < n ; ++i)
+			memcpy(&text[8 * i], TEXT[bytes[i]].data(), 8);
+
+		ofs.write(text.data(), 8 * n);
 	}
 
 	ofs << "\n";
@@ -62,4 +80,3 @@ int main(int argc, char* argv[]) {
 
 	return 0;
 }
-
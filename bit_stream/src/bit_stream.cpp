@@ -16,86 +16,474 @@
 //
 //-------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <bit>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <span>
 #include <string>
+#include <vector>
 #include "bit_stream.h"
 
 using namespace std;
 
-BitStream::BitStream(fstream& fs, bool rw_status) : m_rw_status { rw_status },
-  m_byte_stream { fs, rw_status } {
-	if(rw_status) {
-		m_bit_ptr = -1;
-	} else {
-		m_bit_ptr = 7;
-		m_buf = 0;
-	}
+BitStream::BitStream(fstream& fs, bool rw_status, int n_buffers, size_t buf_size) :
+  m_rw_status { rw_status }, m_byte_stream { fs, rw_status, n_buffers, buf_size } {
+}
+
+BitStream::BitStream(const string& file_name, bool rw_status, int n_buffers, size_t buf_size, bool direct) :
+  m_rw_status { rw_status }, m_byte_stream { file_name, rw_status, n_buffers, buf_size, direct } {
+}
+
+BitStream::BitStream(int fd, bool rw_status, int n_buffers, size_t buf_size) :
+  m_rw_status { rw_status }, m_byte_stream { fd, rw_status, n_buffers, buf_size } {
+}
+
+BitStream::BitStream(vector<uint8_t>& out) : m_rw_status { STREAM_WRITE }, m_byte_stream { out } {
+}
+
+BitStream::BitStream(span<const uint8_t> in) : m_rw_status { STREAM_READ }, m_byte_stream { in } {
 }
 
-int BitStream::read_bit() {
-	if(--m_bit_ptr < 0) {
-		if((m_buf = m_byte_stream.get()) == EOF)
-			return EOF;
+bool BitStream::is_open() {
+	return m_byte_stream.is_open();
+}
+
+//---------------------------------------------------------------------------------
+//
+// Reading keeps the next bits of the stream left-aligned in m_acc, with zeros
+// below them. refill() tops the accumulator up with whole bytes until at least
+// 57 bits are available. When the byte stream has a word available, it is
+// loaded in one go straight from its buffer (or from the file mapping).
+//
+// Once the input is exhausted the accumulator is filled up with the zeros
+// already below the valid bits, counted in m_pad_bits: reads never fail, and
+// reading into the padding (m_acc_bits dropping below m_pad_bits) is recorded
+// in m_overrun when the accumulator is refilled again.
+//
+void BitStream::refill() {
+	if(m_acc_bits <= 56 and m_byte_stream.available() >= 8) {
+		const uint8_t* p = m_byte_stream.data();
+		uint64_t word { };
+		for(int i = 0 ; i < 8 ; ++i)
+			word = (word << 8) | p[i];
 
-		m_bit_ptr = 7;
+		int n = (64 - m_acc_bits) >> 3; // Whole bytes that fit
+		m_acc |= (word >> (64 - 8 * n)) << (64 - 8 * n - m_acc_bits);
+		m_acc_bits += 8 * n;
+		m_byte_stream.skip(n);
+		return;
 	}
 
-	return (m_buf & (0x01 << m_bit_ptr)) >> m_bit_ptr;
+	while(m_acc_bits <= 56) {
+		int c = m_pad_bits == 0 ? m_byte_stream.get() : EOF; // Padding: the input is exhausted
+		if(c == EOF) {
+			if(m_acc_bits < m_pad_bits)
+				m_overrun = true;
+
+			m_pad_bits = min(m_pad_bits, m_acc_bits) + 64 - m_acc_bits;
+			m_acc_bits = 64;
+			return;
+		}
+
+		m_acc |= (uint64_t)c << (56 - m_acc_bits);
+		m_acc_bits += 8;
+	}
 }
 
-uint64_t BitStream::read_n_bits(int n) {
-	uint64_t x { };
-	for(int i = 0 ; i < n ; ++i) {
-		x <<= 1;
-		x |= read_bit();
+uint64_t BitStream::read_n_bits_slow(int n) {
+	if(n > 57) { // More than a single fill guarantees: read it in two parts
+		uint64_t x = read_n_bits(n - 32);
+		return (x << 32) | read_n_bits(32);
 	}
 
+	if(n <= 0)
+		return 0;
+
+	refill();
+
+	uint64_t x = m_acc >> (64 - n);
+	m_acc <<= n;
+	m_acc_bits -= n;
+
 	return x;
 }
 
+//---------------------------------------------------------------------------------
+//
+// Called when skipping at least all the cached bits: whole bytes are then
+// skipped in the byte stream without going through the accumulator
+//
+void BitStream::skip_bits_slow(uint64_t n) {
+	if(m_pad_bits > 0) { // Already at the end of the input
+		if((int64_t)n > m_acc_bits - m_pad_bits)
+			m_overrun = true;
+
+		m_acc = 0;
+		m_acc_bits = 0;
+		return;
+	}
+
+	n -= m_acc_bits;
+	m_acc = 0;
+	m_acc_bits = 0;
+
+	for(uint64_t bytes = n / 8 ; bytes > 0 ; ) {
+		size_t k = min(bytes, (uint64_t)m_byte_stream.available());
+		if(k > 0)
+			m_byte_stream.skip(k);
+		else if(m_byte_stream.get() != EOF)
+			k = 1;
+		else {
+			m_overrun = true;
+			return;
+		}
+
+		bytes -= k;
+	}
+
+	read_n_bits(n % 8);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Rice code with parameter k (0 <= k <= 31): the quotient v >> k in unary (that
+// many zeros and a one), followed by the k low bits of v.
+//
+// Exp-Golomb code of order k (0 <= k <= 31): w = v + 2^k in binary, preceded by
+// as many zeros as w has bits beyond k + 1.
+//
+// Decoding finds the unary prefix with count-leading-zeros on the cached word.
+//
+
+//
+// Counts and consumes the zeros before the next one (which is left in place).
+// The bits below the cached ones are always zero, so a non-zero m_acc has the
+// one among its valid bits.
+//
+uint64_t BitStream::read_zeros() {
+	uint64_t zeros { };
+	while(m_acc == 0) {
+		zeros += m_acc_bits;
+		m_acc_bits = 0;
+		if(m_pad_bits > 0) { // Nothing but zeros up to the end of the input
+			m_overrun = true;
+			return zeros;
+		}
+
+		refill();
+	}
+
+	int z = countl_zero(m_acc);
+	m_acc <<= z;
+	m_acc_bits -= z;
+
+	return zeros + z;
+}
+
+void BitStream::write_rice(uint32_t v, int k) {
+	uint64_t q = v >> k;
+	uint64_t tail = (uint64_t { 1 } << k) | (v & ((uint64_t { 1 } << k) - 1));
+	if(q + 1 + k <= 64) { // Prefix and tail in a single field
+		write_n_bits(tail, q + 1 + k);
+		return;
+	}
+
+	for( ; q >= 32 ; q -= 32)
+		write_n_bits(0, 32);
+
+	write_n_bits(tail, q + 1 + k);
+}
+
+uint32_t BitStream::read_rice(int k) {
+	uint64_t q = read_zeros();
+	skip_bits(1);
+
+	return (q << k) | read_n_bits(k);
+}
+
+void BitStream::write_rice_signed(int32_t v, int k) {
+	write_rice(zigzag(v), k);
+}
+
+int32_t BitStream::read_rice_signed(int k) {
+	return unzigzag(read_rice(k));
+}
+
+void BitStream::write_exp_golomb(uint32_t v, int k) {
+	uint64_t w = (uint64_t)v + (uint64_t { 1 } << k);
+	int len = 64 - countl_zero(w);
+
+	write_n_bits(0, len - 1 - k);
+	write_n_bits(w, len);
+}
+
+uint32_t BitStream::read_exp_golomb(int k) {
+	int zeros = read_zeros();
+
+	return read_n_bits(zeros + 1 + k) - (uint64_t { 1 } << k);
+}
+
+void BitStream::write_exp_golomb_signed(int32_t v, int k) {
+	write_exp_golomb(zigzag(v), k);
+}
+
+int32_t BitStream::read_exp_golomb_signed(int k) {
+	return unzigzag(read_exp_golomb(k));
+}
+
+//---------------------------------------------------------------------------------
+//
+// Whole bytes are taken from the accumulator while it has some cached; once it
+// is empty (which only happens when the stream is byte-aligned) the rest is
+// read straight from the byte stream
+//
+size_t BitStream::read_bytes(span<uint8_t> data) {
+	size_t i { };
+	while(i < data.size()) {
+		if(m_acc_bits == 0)
+			return i + m_byte_stream.read(data.data() + i, data.size() - i);
+
+		if(m_acc_bits - m_pad_bits < 8) {
+			refill();
+			if(m_acc_bits - m_pad_bits < 8) // End of stream
+				break;
+		}
+
+		data[i++] = m_acc >> 56;
+		m_acc <<= 8;
+		m_acc_bits -= 8;
+	}
+
+	return i;
+}
+
+//
+// Same as read_bytes: when byte-aligned, the newline is searched for directly
+// in the byte stream's buffer. The string read so far is returned at the end
+// of the stream.
+//
 string BitStream::read_string() {
-	int c;
 	string s;
 
-	while((c = read_n_bits(8)) != '\n')
+	while(m_acc_bits > m_pad_bits) {
+		if(m_acc_bits - m_pad_bits < 8) {
+			refill();
+			if(m_acc_bits - m_pad_bits < 8)
+				return s;
+		}
+
+		char c = m_acc >> 56;
+		m_acc <<= 8;
+		m_acc_bits -= 8;
+		if(c == '\n')
+			return s;
+
 		s += c;
+	}
+
+	while(true) {
+		const uint8_t* p = m_byte_stream.data();
+		size_t n = m_byte_stream.available();
+		if(n == 0) { // Let get() fetch another block
+			int c = m_byte_stream.get();
+			if(c == EOF or c == '\n')
+				return s;
+
+			s += c;
+			continue;
+		}
+
+		const uint8_t* nl = (const uint8_t*)memchr(p, '\n', n);
+		size_t len = nl != nullptr ? nl - p : n;
+		s.append((const char*)p, len);
+		if(nl != nullptr) {
+			m_byte_stream.skip(len + 1);
+			return s;
+		}
+
+		m_byte_stream.skip(len);
+	}
+}
+
+//---------------------------------------------------------------------------------
+//
+// Writing keeps the pending bits right-aligned in m_acc. Whenever 64 bits are
+// complete they are sent to the byte stream as one big-endian word, so the
+// bit order on disk is the same as writing one bit at a time.
+//
+void BitStream::spill(uint64_t word) {
+	uint8_t bytes[8];
+	for(int i = 0 ; i < 8 ; ++i)
+		bytes[i] = word >> (56 - 8 * i);
 
-	return s;
+	m_byte_stream.write(bytes, 8);
 }
 
 void BitStream::write_bit(int bit) {
-	if(m_bit_ptr < 0) {
-		m_byte_stream.put(m_buf);
-		m_bit_ptr = 7;
-		m_buf = 0;
+	write_n_bits(bit & 0x01, 1);
+}
+
+//
+// Called when the field completes the accumulator word (n >= 64 - m_acc_bits)
+//
+void BitStream::write_n_bits_slow(uint64_t bits, int n) {
+	if(n < 64)
+		bits &= (uint64_t { 1 } << n) - 1;
+
+	// Complete the current word with the top bits of the field and keep the rest
+	int room = 64 - m_acc_bits;
+	int rest = n - room;
+	spill(room == 64 ? bits : (m_acc << room) | (bits >> rest));
+	m_acc = bits;
+	m_acc_bits = rest;
+}
+
+//
+// Sends the whole bytes held in the accumulator to the byte stream
+//
+void BitStream::drain_bytes() {
+	while(m_acc_bits >= 8) {
+		m_acc_bits -= 8;
+		m_byte_stream.put((m_acc >> m_acc_bits) & 0xff);
+	}
+}
+
+//---------------------------------------------------------------------------------
+//
+// When the stream is byte-aligned the data is copied straight into the byte
+// stream; otherwise it is merged in 64-bit words, each shifted into the
+// accumulator with a single write_n_bits
+//
+void BitStream::write_bits(span<const uint8_t> data, uint64_t n_bits) {
+	const uint8_t* p = data.data();
+
+	if(m_acc_bits % 8 == 0) {
+		drain_bytes();
+		m_byte_stream.write(p, n_bits / 8);
+		p += n_bits / 8;
+		n_bits %= 8;
 	}
 
-	m_buf |= (bit & 0x01) << m_bit_ptr--;
+	for( ; n_bits >= 64 ; n_bits -= 64, p += 8) {
+		uint64_t word { };
+		for(int i = 0 ; i < 8 ; ++i)
+			word = (word << 8) | p[i];
+
+		write_n_bits(word, 64);
+	}
+
+	for( ; n_bits >= 8 ; n_bits -= 8)
+		write_n_bits(*p++, 8);
+
+	if(n_bits > 0)
+		write_n_bits(*p >> (8 - n_bits), n_bits);
 }
 
-void BitStream::write_n_bits(uint64_t bits, int n) {
-	for(int i = n - 1 ; i >= 0 ; i--)
-		write_bit(((0x01 << i) & bits) >> i);
+void BitStream::write_bytes(span<const uint8_t> data) {
+	write_bits(data, data.size() * 8);
 }
 
 void BitStream::write_string(const string& s) {
-	for(const char c : s)
-		write_n_bits(c, 8);
-
+	write_bytes(span((const uint8_t*)s.data(), s.size()));
 	write_n_bits('\n', 8); // Mark the end of the string with a newline
 }
 
 off_t BitStream::tell() {
-	return m_byte_stream.tell();
+	if(m_rw_status)
+		return m_byte_stream.tell() - (m_acc_bits - m_pad_bits) / 8;
+
+	return m_byte_stream.tell() + m_acc_bits / 8;
+}
+
+uint64_t BitStream::tell_bit() {
+	if(m_rw_status)
+		return m_byte_stream.tell() * 8 - (m_acc_bits - m_pad_bits);
+
+	return m_byte_stream.tell() * 8 + m_acc_bits;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Repositions a read stream at bit pos: the byte stream moves to the byte
+// holding it, the cached bits are dropped and the leading bits of that byte
+// are skipped
+//
+bool BitStream::seek_bit(uint64_t pos) {
+	if(not m_rw_status or not m_byte_stream.seek(pos / 8))
+		return false;
+
+	m_overrun = overrun(); // Sticky
+	m_acc = 0;
+	m_acc_bits = 0;
+	m_pad_bits = 0;
+	skip_bits(pos % 8);
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+//
+// The trailer is the CRC32C in little-endian order, so that the CRC32C of the
+// whole stream, trailer included, is the constant CRC32C_RESIDUE. This way the
+// reader checks it without knowing in advance where the trailer starts.
+//
+void BitStream::enable_crc() {
+	m_byte_stream.enable_crc();
 }
 
-void BitStream::close() {
+void BitStream::write_crc() {
+	if(m_acc_bits % 8 != 0)
+		write_n_bits(0, 8 - m_acc_bits % 8);
+
+	drain_bytes();
+
+	uint32_t crc = m_byte_stream.crc();
+	for(int i = 0 ; i < 4 ; ++i)
+		m_byte_stream.put((crc >> (8 * i)) & 0xff);
+}
+
+bool BitStream::check_crc() {
+	if(overrun())
+		return false;
+
+	uint64_t n_bytes = (m_acc_bits - m_pad_bits) / 8; // Bytes left after the byte boundary
+	m_acc = 0;
+	m_acc_bits = 0;
+	m_pad_bits = 0;
+
+	while(true) { // Consume the rest of the stream
+		size_t n = m_byte_stream.available();
+		if(n > 0)
+			m_byte_stream.skip(n);
+		else if(m_byte_stream.get() != EOF) // Refills the byte stream
+			n = 1;
+		else
+			break;
+
+		n_bytes += n;
+	}
+
+	return n_bytes == 4 and m_byte_stream.crc() == CRC32C_RESIDUE;
+}
+
+bool BitStream::close() {
 	if(not m_rw_status) {
-		if(m_bit_ptr != 7) // Flush the bit buffer only if there are some bits there
-			m_byte_stream.put(m_buf);
+		// Flush the whole bytes left in the accumulator, then the last partial
+		// byte (padded with zeros) only if there are some bits there
+		drain_bytes();
+
+		if(m_acc_bits > 0)
+			m_byte_stream.put((m_acc << (8 - m_acc_bits)) & 0xff);
+
+		m_acc_bits = 0;
 	}
 
-	m_byte_stream.close(); // Calls byte_stream flush if needed
+	return m_byte_stream.close(); // Calls byte_stream flush if needed
+}
+
+uint64_t BitStream::buffer_waits() {
+	return m_byte_stream.buffer_waits();
 }
 
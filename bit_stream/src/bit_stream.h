@@ -19,19 +19,41 @@
 #ifndef BIT_STREAM_H
 #define BIT_STREAM_H
 
+#include <cstdint>
+#include <span>
 #include <string>
+#include <vector>
 #include <fstream>
 #include "byte_stream.h"
 
 class BitStream {
   private:
 	bool		m_rw_status { STREAM_READ };
-	int			m_buf;
-	int			m_bit_ptr;
+	uint64_t	m_acc { };		// Reading: left-aligned bits; writing: right-aligned bits
+	int			m_acc_bits { };	// Number of valid bits in m_acc
+	int			m_pad_bits { };	// Reading: zero bits past the end of the input among them
+	bool		m_overrun { };	// Reading: some bits were read past the end of the input
 	ByteStream	m_byte_stream;
 
+	void spill(uint64_t word);
+	void drain_bytes();
+	uint64_t read_n_bits_slow(int n);
+	void skip_bits_slow(uint64_t n);
+	uint64_t read_zeros();
+	void write_n_bits_slow(uint64_t bits, int n);
+
   public:
-	BitStream(std::fstream& fs, bool rw_status);
+	// See ByteStream for n_buffers (overlapped I/O), buf_size, direct
+	// (O_DIRECT), file descriptors and the file name "-" (stdin/stdout)
+	BitStream(std::fstream& fs, bool rw_status, int n_buffers = 1, size_t buf_size = BYTE_STREAM_BUF_SIZE);
+	BitStream(const std::string& file_name, bool rw_status, int n_buffers = 1,
+	  size_t buf_size = BYTE_STREAM_BUF_SIZE, bool direct = false);
+	BitStream(int fd, bool rw_status, int n_buffers = 1, size_t buf_size = BYTE_STREAM_BUF_SIZE);
+
+	// In-memory streams, with no file I/O: writing appends to out (complete
+	// after close()), reading takes its bits from in
+	explicit BitStream(std::vector<uint8_t>& out);
+	explicit BitStream(std::span<const uint8_t> in);
 
 	BitStream() = delete;
 	BitStream(const BitStream&) = delete;
@@ -39,15 +61,155 @@ class BitStream {
 	BitStream& operator=(BitStream&&) = delete;
 	BitStream& operator=(const BitStream&) = delete;
 
+	bool is_open();
 	int read_bit();
 	uint64_t read_n_bits(int n);
 	std::string read_string();
 	void write_bit(int bit);
 	void write_n_bits(uint64_t bits, int n);
 	void write_string(const std::string& s);
+
+	// Reading past the end of the input gives zero bits and sets a sticky
+	// overrun flag, so decoding loops need no end-of-stream checks: callers
+	// test overrun() once per block to detect truncated input (tell() and
+	// tell_bit() are not meaningful after an overrun)
+	bool overrun() const { return m_overrun or m_acc_bits < m_pad_bits; }
+
+	// Likewise, a failed read or write sets a sticky error flag (see
+	// ByteStream). Reading, the input ends there, as if truncated: decoders
+	// check error() when they find an overrun. Writing, the output that
+	// follows is dropped: encoders check close(), which returns false when
+	// some of the output is missing.
+	bool error() const { return m_byte_stream.error(); }
+
+	// Lookahead on the cached word, e.g., for table-driven variable-length
+	// decoding: peek_bits(n) returns the next n <= 57 bits without consuming
+	// them, skip_bits(n) consumes n bits, and refill() makes at least 57 bits
+	// available
+	void refill();
+	uint64_t peek_bits(int n);
+	void skip_bits(uint64_t n);
+
+	// Variable-length codes (see bit_stream.cpp for the layouts). The signed
+	// variants zig-zag map 0, -1, 1, -2, ... to 0, 1, 2, 3, ... (see zigzag())
+	void write_rice(uint32_t v, int k);
+	uint32_t read_rice(int k);
+	void write_rice_signed(int32_t v, int k);
+	int32_t read_rice_signed(int k);
+	void write_exp_golomb(uint32_t v, int k = 0);
+	uint32_t read_exp_golomb(int k = 0);
+	void write_exp_golomb_signed(int32_t v, int k = 0);
+	int32_t read_exp_golomb_signed(int k = 0);
+
+	// Appends the first n_bits of data, at any bit alignment. This splices
+	// segments encoded independently (e.g., on worker threads) into in-memory
+	// BitStreams: the segment's n_bits is its tell_bit() before close().
+	void write_bits(std::span<const uint8_t> data, uint64_t n_bits);
+
+	// Whole bytes, copied straight to/from the byte stream when the stream is
+	// byte-aligned. read_bytes returns the number of bytes read.
+	void write_bytes(std::span<const uint8_t> data);
+	size_t read_bytes(std::span<uint8_t> data);
+
+	// Bulk fixed-width fields (1 <= bits <= 16), same layout as one
+	// write_n_bits/read_n_bits call per value (see bit_pack.cpp)
+	void write_packed(std::span<const uint16_t> values, int bits);
+	void read_packed(std::span<uint16_t> values, int bits);
+
+	// Integrity trailer: write_crc() pads the stream to a byte boundary and
+	// appends the CRC32C of all its bytes, check_crc() skips to the byte
+	// boundary and tells whether the rest of the stream is exactly a matching
+	// trailer. Both need enable_crc() right after the stream is opened.
+	void enable_crc();
+	void write_crc();
+	bool check_crc();
+
 	off_t tell();
-	void close();
+	uint64_t tell_bit();
+	bool seek_bit(uint64_t pos); // Reading only
+	bool close();
+	uint64_t buffer_waits();
 };
 
+//-------------------------------------------------------------------------------------------
+//
+// Zig-zag mapping of signed values to unsigned ones, small magnitudes first
+// (0, -1, 1, -2, ... to 0, 1, 2, 3, ...), as done by the signed codes; also
+// for codecs that Rice code residuals themselves
+//
+inline uint32_t zigzag(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+inline int32_t unzigzag(uint32_t u) {
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+//
+// Reversible mid/side transform of integer stereo channels, for the codecs'
+// joint stereo blocks: mid = (left + right) >> 1, side = left - right. The
+// bit dropped from mid is recovered from side, since left + right and side
+// have the same parity. The inverse wraps around instead of overflowing on
+// values no encoder writes (corrupted input).
+//
+inline void to_mid_side(int32_t left, int32_t right, int32_t& mid, int32_t& side) {
+	mid = (left + right) >> 1;
+	side = left - right;
+}
+
+inline void from_mid_side(int32_t mid, int32_t side, int32_t& left, int32_t& right) {
+	int64_t l = mid + (((int64_t)side + (side & 1)) >> 1);
+	left = (int32_t)l;
+	right = (int32_t)(l - side);
+}
+
+//-------------------------------------------------------------------------------------------
+//
+// The common cases of read_n_bits/write_n_bits are inline, so that callers using
+// a constant width (e.g., PackedCodec) get them fully specialized. Refilling and
+// spilling the accumulator is done out of line, in bit_stream.cpp.
+//
+inline uint64_t BitStream::read_n_bits(int n) {
+	if(n > 0 and n <= 57 and n <= m_acc_bits) {
+		uint64_t x = m_acc >> (64 - n);
+		m_acc <<= n;
+		m_acc_bits -= n;
+		return x;
+	}
+
+	return read_n_bits_slow(n);
+}
+
+inline int BitStream::read_bit() {
+	return read_n_bits(1);
+}
+
+inline uint64_t BitStream::peek_bits(int n) {
+	if(m_acc_bits < n)
+		refill();
+
+	return n > 0 ? m_acc >> (64 - n) : 0;
+}
+
+inline void BitStream::skip_bits(uint64_t n) {
+	if(n < (uint64_t)m_acc_bits) {
+		m_acc <<= n;
+		m_acc_bits -= n;
+		return;
+	}
+
+	skip_bits_slow(n);
+}
+
+inline void BitStream::write_n_bits(uint64_t bits, int n) {
+	if(n < 64 - m_acc_bits) {
+		m_acc = (m_acc << n) | (bits & ((uint64_t { 1 } << n) - 1));
+		m_acc_bits += n;
+		return;
+	}
+
+	write_n_bits_slow(bits, n);
+}
+
 #endif
 
@@ -16,21 +16,143 @@
 //
 //-------------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "byte_stream.h"
 
 using namespace std;
 
 //-------------------------------------------------------------------------------------------
 
-ByteStream::ByteStream(fstream& fs, bool rw_status) : m_rw_status { rw_status }, m_fs { fs } {
-	m_buf_limit = m_buf + BYTE_STREAM_BUF_SIZE;
-	if(m_rw_status) { // Open for reading
-		m_buf_ptr = m_buf_limit;
-		m_size = BYTE_STREAM_BUF_SIZE;
+ByteStream::ByteStream(fstream& fs, bool rw_status, int n_buffers, size_t buf_size) :
+  m_buf_size { buf_size }, m_rw_status { rw_status }, m_fs { fs } {
+	init(n_buffers);
+}
+
+//---------------------------------------------------------------------------------
+//
+// When reading a regular file, the whole file is memory-mapped and get() reads
+// straight from the mapping, with no copies and no read calls. Anything else
+// (e.g., a named pipe), or a failed mapping, is read through its descriptor.
+// The file name "-" stands for stdin when reading and stdout when writing.
+//
+ByteStream::ByteStream(const string& file_name, bool rw_status, int n_buffers, size_t buf_size,
+  bool direct) : m_buf_size { buf_size }, m_rw_status { rw_status }, m_fs { m_own_fs } {
+	if(file_name == "-") {
+		m_fd = m_rw_status ? STDIN_FILENO : STDOUT_FILENO;
+		init(n_buffers);
+		return;
+	}
+
+	if(m_rw_status)
+		m_fd = open(file_name.c_str(), O_RDONLY);
+	else {
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+		if(direct)
+			m_fd = open(file_name.c_str(), flags | O_DIRECT, 0666);
+#endif
+		if(m_fd < 0) // Also when the file system has no O_DIRECT (e.g., tmpfs)
+			m_fd = open(file_name.c_str(), flags, 0666);
+	}
+
+	m_own_fd = m_fd >= 0;
+
+	struct stat st;
+	if(m_rw_status and m_fd >= 0 and fstat(m_fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0) {
+		void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if(map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			::close(m_fd); // The mapping stays valid
+			m_fd = -1;
+			m_own_fd = false;
+			m_map = (uint8_t*)map;
+			m_map_size = st.st_size;
+			m_in_memory = true;
+			m_buf = m_buf_ptr = m_map;
+			m_buf_limit = m_map + m_map_size;
+			return;
+		}
+	}
+
+	init(n_buffers);
+}
+
+ByteStream::ByteStream(int fd, bool rw_status, int n_buffers, size_t buf_size) : m_buf_size { buf_size },
+  m_rw_status { rw_status }, m_fd { fd }, m_fs { m_own_fs } {
+	init(n_buffers);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Writing to memory fills the vector directly: the buffer is the free space at
+// its end, and it is grown whenever it fills up
+//
+ByteStream::ByteStream(vector<uint8_t>& out) : m_rw_status { STREAM_WRITE }, m_out { &out },
+  m_fs { m_own_fs } {
+	size_t used = out.size();
+	out.resize(used + BYTE_STREAM_BUF_SIZE);
+	m_buf = m_buf_ptr = out.data() + used;
+	m_buf_limit = out.data() + out.size();
+}
+
+ByteStream::ByteStream(span<const uint8_t> in) : m_rw_status { STREAM_READ }, m_in_memory { true },
+  m_fs { m_own_fs } {
+	m_buf = m_buf_ptr = (uint8_t*)in.data(); // Never written through
+	m_buf_limit = m_buf_ptr + in.size();
+}
+
+ByteStream::~ByteStream() {
+	if(m_map != nullptr)
+		munmap(m_map, m_map_size);
+
+	if(m_own_fd and m_fd >= 0)
+		::close(m_fd);
+}
+
+//---------------------------------------------------------------------------------
+//
+// When reading, [m_buf_ptr, m_buf_limit) holds the bytes not yet consumed.
+// When writing, m_buf_limit is the end of the buffer.
+//
+void ByteStream::init(int n_buffers) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	m_buf_size = clamp(m_buf_size, BYTE_STREAM_MIN_BUF_SIZE, BYTE_STREAM_MAX_BUF_SIZE);
+	m_buf_size = (m_buf_size + page - 1) / page * page;
+
+	struct stat st;
+	if(n_buffers > 1 and m_fd >= 0 and fstat(m_fd, &st) == 0 and S_ISREG(st.st_mode)) {
+		m_uring = make_unique<UringEngine>(m_fd, m_rw_status, n_buffers, m_buf_size);
+		if(not m_uring->is_open())
+			m_uring.reset();
 	}
 
-	else // Open for writing
+	m_alloc = make_aligned_buffer(m_buf_size); // Also what is left after close()
+	m_buf = m_uring and not m_rw_status ? m_uring->buffer() : m_alloc.get();
+
+#ifdef O_DIRECT
+	m_direct = not m_rw_status and m_fd >= 0 and (fcntl(m_fd, F_GETFL) & O_DIRECT) != 0;
+#endif
+
+	if(m_rw_status) // Open for reading
+		m_buf_ptr = m_buf_limit = m_buf;
+
+	else { // Open for writing
 		m_buf_ptr = m_buf;
+		m_buf_limit = m_buf + m_buf_size;
+		if(n_buffers > 1 and not m_uring)
+			m_writer = make_unique<AsyncWriter>([this](const uint8_t* data, size_t n) { write_out(data, n); },
+			  n_buffers, m_buf_size);
+	}
+}
+
+bool ByteStream::is_open() {
+	return m_in_memory or m_out != nullptr or m_fd >= 0 or m_fs.is_open();
 }
 
 //---------------------------------------------------------------------------------
@@ -41,27 +163,153 @@ void ByteStream::put(int c) {
 	*m_buf_ptr++ = c;
 	m_tell++;
 
-	if(m_buf_ptr == m_buf_limit) { // buffer is full: write it
-		m_fs.write((char*)m_buf, BYTE_STREAM_BUF_SIZE);
-		m_buf_ptr = m_buf;
+	if(m_buf_ptr == m_buf_limit) // buffer is full: write it
+		write_block(m_buf_size);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Bulk version of put()
+//
+void ByteStream::write(const uint8_t* data, size_t n) {
+	while(n > 0) {
+		size_t chunk = min(n, (size_t)(m_buf_limit - m_buf_ptr));
+		memcpy(m_buf_ptr, data, chunk);
+		m_buf_ptr += chunk;
+		m_tell += chunk;
+		data += chunk;
+		n -= chunk;
+
+		if(m_buf_ptr == m_buf_limit) // buffer is full: write it
+			write_block(m_buf_size);
 	}
 }
 
 //---------------------------------------------------------------------------------
 //
-// m_buf_ptr points to the next buffer char
+// Writes the first n bytes of the buffer. With a background writer the buffer
+// is handed over to the I/O thread and filling goes on in a free one.
 //
-int ByteStream::get() {
-	if(m_buf_ptr == m_buf_limit) { // buffer is empty: get another block
-		m_fs.read((char*)m_buf, BYTE_STREAM_BUF_SIZE);
-		if((m_size = m_fs.gcount()) == 0)
-			return EOF;
+void ByteStream::write_block(size_t n) {
+	update_crc(m_buf_ptr);
+
+	if(m_out != nullptr) { // The bytes are already in place: make room for more
+		size_t used = m_buf_ptr - m_out->data();
+		m_out->resize(max(used + BYTE_STREAM_BUF_SIZE, 2 * used));
+		m_buf = m_buf_ptr = m_out->data() + used;
+		m_buf_limit = m_out->data() + m_out->size();
+		m_crc_ptr = m_buf;
+		return;
+	}
+
+	if(m_uring) {
+		m_buf = m_uring->submit(m_buf, n);
+		if(m_uring->error())
+			m_error = true;
+	}
+	else if(m_writer)
+		m_buf = m_writer->submit(m_buf, n);
+	else
+		write_out(m_buf, n);
+
+	m_buf_ptr = m_buf;
+	m_buf_limit = m_buf + m_buf_size;
+	m_crc_ptr = m_buf;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Descriptors may take less than n bytes per call (pipes, sockets) and calls
+// may be interrupted by signals. A failed write sets the error flag, and from
+// then on nothing more is written.
+//
+void ByteStream::write_out(const uint8_t* data, size_t n) {
+	if(m_error)
+		return;
+
+	if(m_fd < 0) {
+		if(not m_fs.write((const char*)data, n))
+			m_error = true;
+
+		return;
+	}
+
+	while(n > 0) {
+		ssize_t written = ::write(m_fd, data, n);
+		if(written < 0) {
+			if(errno == EINTR)
+				continue;
+
+			m_error = true;
+			return;
+		}
+
+		data += written;
+		n -= written;
+	}
+}
+
+//
+// Returns as soon as some bytes arrive, so that a pipe is decoded while its
+// writer is still producing; 0 means end of input, or a read error (which
+// sets the error flag)
+//
+size_t ByteStream::read_in(uint8_t* data, size_t n) {
+	if(m_fd < 0) {
+		m_fs.read((char*)data, n);
+		if(m_fs.bad())
+			m_error = true;
+
+		return m_fs.gcount();
+	}
+
+	ssize_t n_read;
+	do
+		n_read = ::read(m_fd, data, n);
+	while(n_read < 0 and errno == EINTR);
+
+	if(n_read < 0)
+		m_error = true;
+
+	return n_read > 0 ? n_read : 0;
+}
 
+//---------------------------------------------------------------------------------
+//
+// Gets another block into the buffer. A mapping or a span has no more blocks.
+//
+bool ByteStream::refill() {
+	if(m_in_memory)
+		return false;
+
+	update_crc(m_buf_limit);
+
+	m_buf_pos = m_tell;
+	if(m_uring) {
+		size_t n;
+		m_buf = m_uring->next(n);
 		m_buf_ptr = m_buf;
-	} else {
-		if(m_buf_ptr - m_buf == m_size)
-			return EOF;
+		m_buf_limit = m_buf + n;
+		if(m_uring->error()) // The data ends early, but it is not the end of the file
+			m_error = true;
 	}
+	else {
+		m_buf_ptr = m_buf;
+		m_buf_limit = m_buf + read_in(m_buf, m_buf_size);
+	}
+
+	m_crc_ptr = m_buf;
+
+	return m_buf_ptr != m_buf_limit;
+}
+
+//---------------------------------------------------------------------------------
+//
+// m_buf_ptr points to the next buffer char
+//
+int ByteStream::get() {
+	if(m_buf_ptr == m_buf_limit and not refill()) // buffer is empty: get another block
+		return EOF;
 
 	m_tell++;
 	return *m_buf_ptr++;
@@ -69,14 +317,97 @@ int ByteStream::get() {
 
 //---------------------------------------------------------------------------------
 //
-// m_buf_ptr points to a free buffer position
+// Bulk version of get()
+//
+size_t ByteStream::read(uint8_t* data, size_t n) {
+	size_t done { };
+	while(done < n) {
+		if(m_buf_ptr == m_buf_limit and not refill())
+			break;
+
+		size_t chunk = min(n - done, (size_t)(m_buf_limit - m_buf_ptr));
+		memcpy(data + done, m_buf_ptr, chunk);
+		m_buf_ptr += chunk;
+		m_tell += chunk;
+		done += chunk;
+	}
+
+	return done;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Moves the read position to byte pos. Within the current block (always the
+// case for mappings and spans) only m_buf_ptr changes; otherwise the file is
+// repositioned and the buffer invalidated (pipes are read up to pos instead).
+//
+bool ByteStream::seek(off_t pos) {
+	if(not m_rw_status or pos < 0)
+		return false;
+
+	if(pos >= m_buf_pos and pos <= m_buf_pos + (m_buf_limit - m_buf)) {
+		m_buf_ptr = m_buf + (pos - m_buf_pos);
+		m_tell = pos;
+		return true;
+	}
+
+	if(m_in_memory)
+		return false;
+
+	if(m_uring) {
+		m_uring->seek(pos);
+		m_buf = m_alloc.get(); // The current buffer is being refilled
+	}
+	else if(m_fd >= 0) {
+		if(lseek(m_fd, pos, SEEK_SET) < 0) {
+			if(errno != ESPIPE or pos < m_tell)
+				return false;
+
+			// Pipes and sockets only go forward: read blocks up to pos
+			while(true) {
+				m_tell += m_buf_limit - m_buf_ptr;
+				m_buf_ptr = m_buf_limit;
+				if(not refill())
+					return false;
+
+				if(pos <= m_buf_pos + (m_buf_limit - m_buf)) {
+					m_buf_ptr = m_buf + (pos - m_buf_pos);
+					m_tell = pos;
+					return true;
+				}
+			}
+		}
+	}
+	else {
+		m_fs.clear();
+		if(not m_fs.seekg(pos))
+			return false;
+	}
+
+	m_buf_ptr = m_buf_limit = m_buf;
+	m_crc_ptr = m_buf;
+	m_buf_pos = m_tell = pos;
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+//
+// m_buf_ptr points to a free buffer position. O_DIRECT needs whole sectors at
+// aligned offsets, which only full buffers are, so from a partial buffer on the
+// file is written through the page cache.
 //
 void ByteStream::flush() {
 	size_t n_bytes_to_write = m_buf_ptr - m_buf;
 
 	if(n_bytes_to_write != 0) { // If buf is not empty
-		m_fs.write((char*)m_buf, n_bytes_to_write);
-		m_buf_ptr = m_buf;
+#ifdef O_DIRECT
+		if(m_direct) {
+			fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+			m_direct = false;
+		}
+#endif
+		write_block(n_bytes_to_write);
 	}
 }
 
@@ -88,12 +419,91 @@ off_t ByteStream::tell() {
 
 //---------------------------------------------------------------------------------
 
-void ByteStream::close() {
-	if(not m_rw_status)
+//
+// Writing, the data is only known to be out once every buffer is written and
+// the descriptor closed (some file systems report errors on close only)
+//
+bool ByteStream::close() {
+	if(m_out != nullptr) { // Drop the unused space at the end of the vector
+		update_crc(m_buf_ptr);
+		m_out->resize(m_buf_ptr - m_out->data());
+		m_out = nullptr;
+		return true;
+	}
+
+	if(m_in_memory) {
+		if(m_map != nullptr)
+			munmap(m_map, m_map_size);
+
+		m_map = nullptr;
+		m_in_memory = false;
+		m_buf = m_buf_ptr = m_buf_limit = m_alloc.get();
+		return true;
+	}
+
+	if(not m_rw_status) {
 		this->flush();
+		if(m_uring)
+			m_uring->finish();
+		if(m_writer)
+			m_writer->finish(); // Wait until every queued buffer is written
+	}
+
+	if(m_uring) { // Its buffers go away
+		if(m_uring->error())
+			m_error = true;
 
-	m_fs.close();
+		m_uring.reset();
+		m_buf = m_buf_ptr = m_buf_limit = m_alloc.get();
+	}
+
+	if(m_fd >= 0) {
+		if(m_own_fd and ::close(m_fd) < 0 and not m_rw_status)
+			m_error = true;
+
+		m_fd = -1;
+		return not m_error;
+	}
+
+	if(m_fs.is_open()) {
+		m_fs.close();
+		if(m_fs.fail() and not m_rw_status)
+			m_error = true;
+	}
+
+	return not m_error;
 }
 
 //---------------------------------------------------------------------------------
 
+uint64_t ByteStream::buffer_waits() {
+	if(m_uring)
+		return m_uring->waits();
+
+	return m_writer ? m_writer->waits() : 0;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Reading from memory has no refills: the whole input is checksummed when the
+// CRC is asked for
+//
+void ByteStream::enable_crc() {
+	m_crc_on = true;
+	m_crc = 0;
+	m_crc_ptr = m_buf;
+}
+
+void ByteStream::update_crc(const uint8_t* end) {
+	if(m_crc_on and end > m_crc_ptr) {
+		m_crc = crc32c(m_crc, m_crc_ptr, end - m_crc_ptr);
+		m_crc_ptr = end;
+	}
+}
+
+uint32_t ByteStream::crc() {
+	update_crc(m_buf_ptr);
+	return m_crc;
+}
+
+//---------------------------------------------------------------------------------
@@ -19,25 +19,82 @@
 #ifndef BYTE_STREAM_H
 #define BYTE_STREAM_H
 
+#include <atomic>
 #include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
 #include <cstdint>
+#include "aligned_buffer.h"
+#include "async_writer.h"
+#include "crc32c.h"
+#include "uring_engine.h"
 
-const int BYTE_STREAM_BUF_SIZE = 65536;
+const int BYTE_STREAM_BUF_SIZE = 65536;		// Default buffer size
+const size_t BYTE_STREAM_MIN_BUF_SIZE = 4096;
+const size_t BYTE_STREAM_MAX_BUF_SIZE = 64 << 20;
 const bool STREAM_READ = true;
 const bool STREAM_WRITE = false;
 
 class ByteStream {
   private:
-	uint8_t			m_buf[BYTE_STREAM_BUF_SIZE];
+	uint8_t*		m_buf { };		// Buffer in use (the mapping or span when reading from memory)
+	size_t			m_buf_size { BYTE_STREAM_BUF_SIZE };
+	AlignedBuffer	m_alloc;		// Page-aligned buffer, not needed by in-memory streams
 	uint8_t*		m_buf_ptr;
 	uint8_t*		m_buf_limit;
-	int				m_size;
+	off_t			m_buf_pos { };	// Reading: file offset of m_buf[0]
 	bool			m_rw_status { STREAM_READ };
 	off_t			m_tell { };
+	bool			m_in_memory { };	// Reading from a mapping or a span (no refills)
+	uint8_t*		m_map { };		// Memory-mapped input file, if any
+	size_t			m_map_size { };
+	std::vector<uint8_t>*	m_out { };	// Output vector, when writing to memory
+	int				m_fd { -1 };	// Descriptor, when not using an fstream
+	bool			m_own_fd { };	// Closed by close()
+	bool			m_direct { };	// Writing with O_DIRECT (whole aligned buffers only)
+	std::fstream	m_own_fs;		// Placeholder for m_fs when there is no fstream
 	std::fstream&	m_fs;
+	std::unique_ptr<AsyncWriter>	m_writer;	// Background writer, if enabled
+	std::unique_ptr<UringEngine>	m_uring;	// io_uring engine, if enabled (replaces m_writer)
+	std::atomic<bool>	m_error { };	// Some bytes could not be read or written (set by the I/O thread too)
+	bool			m_crc_on { };
+	uint32_t		m_crc { };		// CRC32C of the bytes before m_crc_ptr
+	const uint8_t*	m_crc_ptr { };	// First byte of the buffer not yet in m_crc
+
+	void init(int n_buffers);
+	bool refill();
+	void write_block(size_t n);
+	void write_out(const uint8_t* data, size_t n);
+	size_t read_in(uint8_t* data, size_t n);
+	void update_crc(const uint8_t* end);
 
   public:
-	ByteStream(std::fstream& fs, bool rw_status);
+	// With n_buffers > 1, I/O overlaps with the caller's work. On regular files
+	// io_uring keeps the buffers in flight, written behind or read ahead, with
+	// no extra thread; where io_uring is not available, or for other kinds of
+	// files, full buffers are written by a background thread (reads are plain).
+	// buf_size is clamped to [BYTE_STREAM_MIN_BUF_SIZE, BYTE_STREAM_MAX_BUF_SIZE]
+	// and rounded up to whole pages; larger buffers mean fewer system calls.
+	ByteStream(std::fstream& fs, bool rw_status, int n_buffers = 1,
+	  size_t buf_size = BYTE_STREAM_BUF_SIZE);
+
+	// direct opens a file for writing with O_DIRECT, bypassing the page cache
+	// (for large sequential writes); it is ignored if the file system does
+	// not support it
+	ByteStream(const std::string& file_name, bool rw_status, int n_buffers = 1,
+	  size_t buf_size = BYTE_STREAM_BUF_SIZE, bool direct = false);
+
+	// Any file descriptor: stdin/stdout, pipes, FIFOs, sockets or files. The
+	// descriptor is not closed by close(). O_DIRECT descriptors are handled.
+	ByteStream(int fd, bool rw_status, int n_buffers = 1, size_t buf_size = BYTE_STREAM_BUF_SIZE);
+
+	// In-memory streams: writing appends to out (its final size is set by
+	// close()), reading goes straight through the bytes of in
+	explicit ByteStream(std::vector<uint8_t>& out);
+	explicit ByteStream(std::span<const uint8_t> in);
+	~ByteStream();
 
 	ByteStream() = delete;
 	ByteStream(const ByteStream&) = delete;
@@ -45,11 +102,35 @@ class ByteStream {
 	ByteStream& operator=(ByteStream&&) = delete;
 	ByteStream& operator=(const ByteStream&) = delete;
 
+	bool is_open();
 	void put(int c);
+	void write(const uint8_t* data, size_t n);
 	int get();
+	size_t read(uint8_t* data, size_t n); // Returns the number of bytes read
+	bool seek(off_t pos); // Reading only
 	void flush();
 	off_t tell();
-	void close();
+	bool close(); // Returns false if the output is incomplete (see error())
+	uint64_t buffer_waits(); // Times a full buffer had to wait for a free one
+
+	// A failed write (e.g., a full disk or a closed pipe) or read sets a
+	// sticky error flag. Writing, the bytes that follow are dropped, and
+	// buffers in flight only report their errors once written, i.e., by
+	// close(). Reading, the input ends there, as at the end of the file: a
+	// reader that runs out of input tells the two apart with error().
+	bool error() const { return m_error; }
+
+	// CRC32C of every byte written, or consumed when reading, since the start
+	// of the stream. Each buffer is checksummed as it is flushed or refilled,
+	// while still in cache. enable_crc() must be called before the first
+	// flush or refill, and crc() is meaningless after a seek.
+	void enable_crc();
+	uint32_t crc();
+
+	// Direct access to the bytes available for reading (used by BitStream)
+	const uint8_t* data() const { return m_buf_ptr; }
+	size_t available() const { return m_buf_limit - m_buf_ptr; }
+	void skip(size_t n) { m_buf_ptr += n; m_tell += n; }
 };
 
 #endif
@@ -0,0 +1,20 @@
+//-------------------------------------------------------------------------------------------
+//
+// CRC32C (Castagnoli polynomial), as used by iSCSI, ext4 and SSE4.2's crc32
+// instruction. Calls can be chained, as in zlib's crc32(): start with 0 and
+// pass the result of each call to the next one.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Appending the little-endian CRC32C of a message to it always gives this CRC32C
+const uint32_t CRC32C_RESIDUE = 0x48674bc7;
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t n);
+
+#endif
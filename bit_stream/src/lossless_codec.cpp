@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+#include "lossless_codec.h"
+#include "lpc_codec.h"
+#include "rice_codec.h"
+
+using namespace std;
+
+namespace {
+
+enum SubframeType { SUBFRAME_CONSTANT, SUBFRAME_VERBATIM, SUBFRAME_FIXED, SUBFRAME_LPC };
+
+constexpr int MAX_FIXED_ORDER = 4;
+constexpr int MAX_PARTITION_ORDER = 8;
+constexpr int MAX_RICE_K = 18; // Residuals of 16-bit samples, zig-zag mapped, take up to 18 bits
+
+// The fixed polynomial predictors, as linear predictors with integer coefficients
+constexpr array<LpcPredictor, MAX_FIXED_ORDER + 1> FIXED_PREDICTORS { {
+	{ 0, 0, { } },
+	{ 1, 0, { 1 } },
+	{ 2, 0, { 2, -1 } },
+	{ 3, 0, { 3, -3, 1 } },
+	{ 4, 0, { 4, -6, 4, -1 } },
+} };
+
+// Rice parameters of the parts of a frame's residual, and its size
+struct Partitioning {
+	int											order { };
+	array<uint8_t, 1 << MAX_PARTITION_ORDER>	k { };
+	uint64_t									bits { };
+};
+
+//---------------------------------------------------------------------------------
+//
+// The k giving the fewest bits for count values adding up to sum, their size
+// taken as count * (k + 1) + (sum >> k): at most count bits off the exact one,
+// and known from the sum alone
+//
+int best_k(uint64_t count, uint64_t sum, uint64_t& bits) {
+	int k { };
+	bits = count + sum;
+	for(int j = 1 ; j <= MAX_RICE_K ; ++j) {
+		uint64_t b = count * (j + 1) + (sum >> j);
+		if(b < bits) {
+			k = j;
+			bits = b;
+		}
+	}
+
+	return k;
+}
+
+//
+// The partition order with the fewest bits for the residual u of samples
+// pred_order to n - 1. The sums of the finest parts are added pairwise to
+// get those of the coarser ones.
+//
+Partitioning choose_partitioning(const uint32_t* u, size_t n, int pred_order) {
+	int max_order { };
+	while(max_order < MAX_PARTITION_ORDER and n % (size_t { 2 } << max_order) == 0
+	  and (n >> (max_order + 1)) > (size_t)pred_order)
+		++max_order;
+
+	array<uint64_t, 1 << MAX_PARTITION_ORDER> sums;
+	size_t len = n >> max_order;
+	for(int i = 0 ; i < (1 << max_order) ; ++i) {
+		const uint32_t* begin = u + (i == 0 ? 0 : i * len - pred_order);
+		sums[i] = accumulate(begin, u + (i + 1) * len - pred_order, uint64_t { });
+	}
+
+	Partitioning best;
+	best.bits = UINT64_MAX;
+	for(int order = max_order ; order >= 0 ; --order) {
+		Partitioning p;
+		p.order = order;
+		p.bits = 4;
+		len = n >> order;
+		for(int i = 0 ; i < (1 << order) ; ++i) {
+			uint64_t bits;
+			p.k[i] = best_k(len - (i == 0 ? pred_order : 0), sums[i], bits);
+			p.bits += 5 + bits;
+		}
+		if(p.bits < best.bits)
+			best = p;
+
+		for(int i = 0 ; i < (1 << order) / 2 ; ++i)
+			sums[i] = sums[2 * i] + sums[2 * i + 1];
+	}
+
+	return best;
+}
+
+void write_residual(BitStream& bs, const uint32_t* u, size_t n, int pred_order, const Partitioning& p) {
+	bs.write_n_bits(p.order, 4);
+	size_t len = n >> p.order;
+	for(int i = 0 ; i < (1 << p.order) ; ++i) {
+		size_t count = len - (i == 0 ? pred_order : 0);
+		bs.write_n_bits(p.k[i], 5);
+		for(size_t j = 0 ; j < count ; ++j)
+			bs.write_rice(u[j], p.k[i]);
+
+		u += count;
+	}
+}
+
+//
+// The linear predictor with the fewest estimated bits: about log2 of the
+// residual's deviation per sample, plus the coefficients and warm-up. Order 0
+// means none is worth trying.
+//
+LpcPredictor choose_lpc_predictor(const int32_t* x, size_t n, int max_order) {
+	array<LpcPredictor, LPC_MAX_ORDER + 1> predictors;
+	array<double, LPC_MAX_ORDER + 1> err;
+	max_order = lpc_predictors(x, n, max_order, predictors.data(), err.data());
+
+	int best { };
+	double best_bits = HUGE_VAL;
+	for(int p = 1 ; p <= max_order ; ++p) {
+		double deviation = sqrt(max(err[p], 0.0) / n);
+		double bits_per_sample = deviation > 1 ? log2(deviation) + 2 : 1;
+		double total = (n - p) * bits_per_sample + p * 32;
+		if(total < best_bits) {
+			best = p;
+			best_bits = total;
+		}
+	}
+
+	return predictors[best];
+}
+
+void encode_channel(BitStream& bs, const short* s, size_t n, int stride, int max_lpc_order) {
+	vector<int32_t> x(n);
+	for(size_t i = 0 ; i < n ; ++i)
+		x[i] = s[i * stride];
+
+	if(all_of(x.begin(), x.end(), [&x](int32_t v) { return v == x[0]; })) {
+		bs.write_n_bits(SUBFRAME_CONSTANT, 2);
+		bs.write_n_bits(x[0], 16);
+		return;
+	}
+
+	// Every predictor is tried on the samples, verbatim being the fallback
+	SubframeType best_type = SUBFRAME_VERBATIM;
+	uint64_t best_bits = 2 + 16 * n;
+	LpcPredictor best_predictor;
+	Partitioning best_partitioning;
+	vector<uint32_t> u(n), best_u(n);
+
+	auto consider = [&](SubframeType type, const LpcPredictor& p) {
+		for(size_t i = p.order ; i < n ; ++i)
+			u[i - p.order] = zigzag(x[i] - lpc_predict(p, x.data() + i));
+
+		Partitioning partitioning = choose_partitioning(u.data(), n, p.order);
+		uint64_t bits = 2 + (type == SUBFRAME_FIXED ? 3 : 5 + 4 + 16 * p.order) + 16 * p.order + partitioning.bits;
+		if(bits < best_bits) {
+			best_type = type;
+			best_bits = bits;
+			best_predictor = p;
+			best_partitioning = partitioning;
+			swap(u, best_u);
+		}
+	};
+
+	for(int order = 0 ; order <= MAX_FIXED_ORDER and (size_t)order < n ; ++order)
+		consider(SUBFRAME_FIXED, FIXED_PREDICTORS[order]);
+
+	if(max_lpc_order > 0) {
+		LpcPredictor p = choose_lpc_predictor(x.data(), n, max_lpc_order);
+		if(p.order > 0)
+			consider(SUBFRAME_LPC, p);
+	}
+
+	bs.write_n_bits(best_type, 2);
+	if(best_type == SUBFRAME_VERBATIM) {
+		for(int32_t v : x)
+			bs.write_n_bits(v, 16);
+
+		return;
+	}
+
+	const LpcPredictor& p = best_predictor;
+	if(best_type == SUBFRAME_FIXED)
+		bs.write_n_bits(p.order, 3);
+	else {
+		bs.write_n_bits(p.order - 1, 5);
+		bs.write_n_bits(p.shift, 4);
+		for(int j = 0 ; j < p.order ; ++j)
+			bs.write_n_bits(p.coefs[j], 16);
+	}
+
+	for(int i = 0 ; i < p.order ; ++i)
+		bs.write_n_bits(x[i], 16);
+
+	write_residual(bs, best_u.data(), n, p.order, best_partitioning);
+}
+
+bool decode_channel(BitStream& bs, short* s, size_t n, int stride, int32_t* x) {
+	int type = bs.read_n_bits(2);
+	if(type == SUBFRAME_CONSTANT)
+		fill_n(x, n, (int16_t)bs.read_n_bits(16));
+	else if(type == SUBFRAME_VERBATIM)
+		for(size_t i = 0 ; i < n ; ++i)
+			x[i] = (int16_t)bs.read_n_bits(16);
+	else {
+		LpcPredictor p;
+		if(type == SUBFRAME_FIXED) {
+			int order = bs.read_n_bits(3);
+			if(order > MAX_FIXED_ORDER)
+				return false;
+
+			p = FIXED_PREDICTORS[order];
+		}
+		else {
+			p.order = bs.read_n_bits(5) + 1;
+			p.shift = bs.read_n_bits(4);
+			for(int j = 0 ; j < p.order ; ++j)
+				p.coefs[j] = (int16_t)bs.read_n_bits(16);
+		}
+		if((size_t)p.order >= n)
+			return false;
+
+		for(int i = 0 ; i < p.order ; ++i)
+			x[i] = (int16_t)bs.read_n_bits(16);
+
+		int partition_order = bs.read_n_bits(4);
+		if(partition_order > MAX_PARTITION_ORDER or n % ((size_t)1 << partition_order) != 0
+		  or (n >> partition_order) <= (size_t)p.order)
+			return false;
+
+		// The residuals go in place of their samples, which are then predicted
+		// in order, from the ones already rebuilt
+		size_t len = n >> partition_order;
+		int32_t* r = x + p.order;
+		for(int i = 0 ; i < (1 << partition_order) ; ++i) {
+			size_t count = len - (i == 0 ? p.order : 0);
+			int k = bs.read_n_bits(5);
+			rice_read_signed(bs, span(r, count), k);
+			r += count;
+		}
+
+		for(size_t i = p.order ; i < n ; ++i)
+			x[i] = (int16_t)(x[i] + lpc_predict(p, x + i));
+	}
+
+	for(size_t i = 0 ; i < n ; ++i)
+		s[i * stride] = x[i];
+
+	return true;
+}
+
+}
+
+//---------------------------------------------------------------------------------
+
+void lossless_encode_frame(BitStream& bs, span<const short> samples, int channels, uint32_t index,
+  int max_lpc_order) {
+	bs.write_n_bits(LOSSLESS_SYNC, 16);
+	bs.write_n_bits(index, 32);
+
+	size_t n = samples.size() / channels;
+	for(int c = 0 ; c < channels ; ++c)
+		encode_channel(bs, samples.data() + c, n, channels, max_lpc_order);
+
+	bs.write_n_bits(0, (8 - bs.tell_bit() % 8) % 8);
+}
+
+bool lossless_decode_frame(BitStream& bs, span<short> samples, int channels, uint32_t index) {
+	if(bs.read_n_bits(16) != LOSSLESS_SYNC or bs.read_n_bits(32) != index)
+		return false;
+
+	size_t n = samples.size() / channels;
+	vector<int32_t> x(n);
+	for(int c = 0 ; c < channels ; ++c)
+		if(not decode_channel(bs, samples.data() + c, n, channels, x.data()))
+			return false;
+
+	bs.skip_bits((8 - bs.tell_bit() % 8) % 8);
+	return true;
+}
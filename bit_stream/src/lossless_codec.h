@@ -0,0 +1,51 @@
+//-------------------------------------------------------------------------------------------
+//
+// Lossless coding of 16-bit samples, in the manner of FLAC: the samples are
+// split in frames of up to 65535 frames (WAV frames, i.e., one sample per
+// channel), each coded on its own and starting on a byte boundary with a sync
+// code, so frames can be encoded in parallel and a decoder can tell when it
+// lost its place. Each channel of a frame is a subframe, of the type giving
+// the fewest bits: a constant, the samples verbatim, or the residual of a
+// fixed polynomial predictor (orders 0 to 4) or of a linear predictor
+// (Levinson-Durbin, see lpc_codec.h), with partitioned Rice coding.
+//
+// Frame layout:
+//
+//   sync (16 bits, LOSSLESS_SYNC), frame index (32 bits)
+//   for each channel, a subframe:
+//     type (2 bits): 0 - constant, 1 - verbatim, 2 - fixed, 3 - LPC
+//     constant: the sample (16 bits)
+//     verbatim: the samples (16 bits each)
+//     fixed: order (3 bits); LPC: order - 1 (5 bits), shift (4 bits) and the
+//     order coefficients (16 bits each, two's complement, scaled by 2^shift)
+//     fixed and LPC: the first order samples (16 bits each), then the
+//     residual of the others: partition order p (4 bits, 0 to 8) and, for
+//     each of the 2^p equal parts of the frame, k (5 bits) and its samples'
+//     residuals, Rice coded (the first part leaves the first order out)
+//   zero bits up to the byte boundary
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef LOSSLESS_CODEC_H
+#define LOSSLESS_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "bit_stream.h"
+
+constexpr uint16_t LOSSLESS_SYNC = 0xfff8;
+constexpr size_t LOSSLESS_MAX_FRAME_SIZE = 65535;
+
+// samples holds a frame of at most LOSSLESS_MAX_FRAME_SIZE frames of channels
+// samples; 0 <= max_lpc_order <= LPC_MAX_ORDER (0 tries the fixed predictors
+// only). The stream must be byte-aligned.
+void lossless_encode_frame(BitStream& bs, std::span<const short> samples, int channels, uint32_t index,
+  int max_lpc_order);
+
+// Decodes the frame with the given index into samples, sized for its frames.
+// Returns false if the input has no such frame where expected (lost sync or
+// corrupted data); truncated input shows in bs.overrun().
+bool lossless_decode_frame(BitStream& bs, std::span<short> samples, int channels, uint32_t index);
+
+#endif
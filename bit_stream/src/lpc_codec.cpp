@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <numbers>
+#include <span>
+#include <vector>
+#include "lpc_codec.h"
+#include "rice_codec.h"
+
+using namespace std;
+
+namespace {
+
+//
+// Same step as the uniform quantizer of wav_quant_enc: 2^bits levels over the
+// 16-bit range
+//
+int32_t quantizer_step(int bits) {
+	return max(1L, lround(65535.0 / ((1 << bits) - 1)));
+}
+
+int32_t quantize(int32_t e, int32_t step) {
+	int32_t q = (abs(e) + step / 2) / step;
+	return e < 0 ? -q : q;
+}
+
+//
+// How a channel of a block is quantized. Mono, left and right channels take
+// the step of the 'bits'-bit quantizer. As left = mid + side / 2, the mid and
+// side channels of joint stereo blocks take it scaled by 1 / sqrt(2) and
+// sqrt(2), rounded down, so that left and right keep the same mean squared
+// error, i.e., SNR (their peak error is larger, though); the warm-up of mid
+// and side needs one more bit, and the side a wider range.
+//
+struct ChannelQuantizer {
+	int32_t		step;
+	int32_t		min, max;		// Range of the samples
+	int			warmup_bits;	// Width of the zig-zag mapped warm-up levels, and largest k
+};
+
+ChannelQuantizer sample_quantizer(int bits) {
+	return { quantizer_step(bits), -32768, 32767, bits + 1 };
+}
+
+ChannelQuantizer mid_quantizer(int bits) {
+	return { max(1, (int32_t)(quantizer_step(bits) / numbers::sqrt2)), -32768, 32767, bits + 2 };
+}
+
+ChannelQuantizer side_quantizer(int bits) {
+	return { max(1, (int32_t)(quantizer_step(bits) * numbers::sqrt2)), -65535, 65535, bits + 2 };
+}
+
+int32_t clamp_sample(int64_t x, const ChannelQuantizer& q) {
+	return clamp<int64_t>(x, q.min, q.max);
+}
+
+//---------------------------------------------------------------------------------
+//
+// r[lag] for lag = 0..max_order. The loop over the lags is innermost, so that
+// its independent sums are computed in vector registers; x holds max_order
+// zeros after its n samples.
+//
+void autocorrelation(const double* x, size_t n, int max_order, double* r) {
+	array<double, LPC_MAX_ORDER + 1> acc { };
+	for(size_t i = 0 ; i < n ; ++i) {
+		double xi = x[i];
+		for(int lag = 0 ; lag <= max_order ; ++lag)
+			acc[lag] += xi * x[i + lag];
+	}
+
+	copy_n(acc.begin(), max_order + 1, r);
+}
+
+//
+// Levinson-Durbin recursion: a[p] holds the coefficients of the order p
+// predictor, err[p] its prediction error energy
+//
+int levinson_durbin(const double* r, int max_order, array<array<double, LPC_MAX_ORDER>, LPC_MAX_ORDER + 1>& a,
+  double* err) {
+	err[0] = r[0];
+	for(int p = 1 ; p <= max_order ; ++p) {
+		if(err[p - 1] <= 0)
+			return p - 1;
+
+		double acc = r[p];
+		for(int j = 0 ; j < p - 1 ; ++j)
+			acc -= a[p - 1][j] * r[p - 1 - j];
+
+		double k = acc / err[p - 1];
+		for(int j = 0 ; j < p - 1 ; ++j)
+			a[p][j] = a[p - 1][j] - k * a[p - 1][p - 2 - j];
+
+		a[p][p - 1] = k;
+		err[p] = err[p - 1] * (1 - k * k);
+	}
+
+	return max_order;
+}
+
+//
+// Scales the coefficients to 16-bit integers, with as many fractional bits
+// (up to 15) as the largest one allows
+//
+LpcPredictor quantize_coefs(const array<double, LPC_MAX_ORDER>& a, int order) {
+	LpcPredictor p;
+	p.order = order;
+
+	double max_abs { };
+	for(int j = 0 ; j < order ; ++j)
+		max_abs = max(max_abs, fabs(a[j]));
+
+	p.shift = max_abs > 0 ? clamp(14 - ilogb(max_abs), 0, 15) : 15;
+	for(int j = 0 ; j < order ; ++j)
+		p.coefs[j] = clamp<long>(lround(ldexp(a[j], p.shift)), -32768, 32767);
+
+	return p;
+}
+
+//
+// The order with the fewest estimated bits: about log2 of the residual's
+// deviation in quantizer steps per sample, plus the coefficients and warm-up
+//
+LpcPredictor choose_predictor(const int32_t* x, size_t n, const ChannelQuantizer& q, int max_order) {
+	array<LpcPredictor, LPC_MAX_ORDER + 1> predictors;
+	array<double, LPC_MAX_ORDER + 1> err;
+	max_order = lpc_predictors(x, n, max_order, predictors.data(), err.data());
+
+	int best { };
+	double best_bits = HUGE_VAL;
+	for(int p = 0 ; p <= max_order ; ++p) {
+		double deviation = sqrt(max(err[p], 0.0) / n) / q.step;
+		double bits_per_sample = deviation > 1 ? log2(deviation) + 2 : 1;
+		double total = (n - p) * bits_per_sample + p * (16 + q.warmup_bits);
+		if(total < best_bits) {
+			best = p;
+			best_bits = total;
+		}
+	}
+
+	return predictors[best];
+}
+
+//
+// A channel of a block, quantized in closed loop with its predictor: the
+// zig-zag mapped levels of the warm-up and of the residuals, the Rice
+// parameter of these, and the size of the whole
+//
+struct QuantizedChannel {
+	LpcPredictor						predictor;
+	array<uint32_t, LPC_BLOCK_FRAMES>	u;
+	int									k;
+	uint64_t							bits;
+};
+
+void quantize_channel(const int32_t* x, size_t n, const ChannelQuantizer& q, const LpcPredictor& p,
+  QuantizedChannel& qc) {
+	qc.predictor = p;
+	array<int32_t, LPC_BLOCK_FRAMES> rec;
+	for(int i = 0 ; i < p.order ; ++i) {
+		int32_t level = quantize(x[i], q.step);
+		rec[i] = clamp_sample((int64_t)level * q.step, q);
+		qc.u[i] = zigzag(level);
+	}
+
+	for(size_t i = p.order ; i < n ; ++i) {
+		int32_t pred = lpc_predict(p, rec.data() + i);
+		int32_t level = quantize(x[i] - pred, q.step);
+		rec[i] = clamp_sample(pred + (int64_t)level * q.step, q);
+		qc.u[i] = zigzag(level);
+	}
+
+	span<const uint32_t> residuals(qc.u.data() + p.order, n - p.order);
+	qc.k = rice_best_k(residuals, q.warmup_bits);
+	qc.bits = 6 + (p.order > 0 ? 4 + 16 * p.order : 0) + p.order * q.warmup_bits + 5 + rice_cost(residuals, qc.k);
+}
+
+void encode_channel(BitStream& bs, size_t n, const ChannelQuantizer& q, const QuantizedChannel& qc) {
+	const LpcPredictor& p = qc.predictor;
+	bs.write_n_bits(p.order, 6);
+	if(p.order > 0) {
+		bs.write_n_bits(p.shift, 4);
+		for(int j = 0 ; j < p.order ; ++j)
+			bs.write_n_bits(p.coefs[j], 16);
+	}
+
+	for(int i = 0 ; i < p.order ; ++i)
+		bs.write_n_bits(qc.u[i], q.warmup_bits);
+
+	bs.write_n_bits(qc.k, 5);
+	for(size_t i = p.order ; i < n ; ++i)
+		bs.write_rice(qc.u[i], qc.k);
+}
+
+void decode_channel(BitStream& bs, int32_t* rec, size_t n, const ChannelQuantizer& q) {
+	LpcPredictor p;
+	p.order = min<size_t>(bs.read_n_bits(6), min<size_t>(LPC_MAX_ORDER, n)); // Bounded even when corrupted
+	if(p.order > 0) {
+		p.shift = bs.read_n_bits(4);
+		for(int j = 0 ; j < p.order ; ++j)
+			p.coefs[j] = (int16_t)bs.read_n_bits(16);
+	}
+
+	for(int i = 0 ; i < p.order ; ++i)
+		rec[i] = clamp_sample((int64_t)unzigzag(bs.read_n_bits(q.warmup_bits)) * q.step, q);
+
+	int k = bs.read_n_bits(5);
+	array<int32_t, LPC_BLOCK_FRAMES> levels;
+	rice_read_signed(bs, span(levels.data(), n - p.order), k);
+
+	for(size_t i = p.order ; i < n ; ++i)
+		rec[i] = clamp_sample(lpc_predict(p, rec + i) + (int64_t)levels[i - p.order] * q.step, q);
+}
+
+void encode_block(BitStream& bs, const short* s, size_t n, int channels, int bits, int max_order) {
+	ChannelQuantizer q = sample_quantizer(bits);
+	array<array<int32_t, LPC_BLOCK_FRAMES>, 2> x;
+	array<QuantizedChannel, 2> lr;
+
+	if(channels != 2) {
+		for(int c = 0 ; c < channels ; ++c) {
+			for(size_t i = 0 ; i < n ; ++i)
+				x[0][i] = s[i * channels + c];
+
+			quantize_channel(x[0].data(), n, q, choose_predictor(x[0].data(), n, q, max_order), lr[0]);
+			encode_channel(bs, n, q, lr[0]);
+		}
+
+		return;
+	}
+
+	// Stereo: left and right, or their mid and side, whichever gives the
+	// fewer bits
+	array<array<int32_t, LPC_BLOCK_FRAMES>, 2> ms;
+	for(size_t i = 0 ; i < n ; ++i) {
+		x[0][i] = s[2 * i];
+		x[1][i] = s[2 * i + 1];
+		to_mid_side(x[0][i], x[1][i], ms[0][i], ms[1][i]);
+	}
+
+	array<ChannelQuantizer, 2> ms_q { mid_quantizer(bits), side_quantizer(bits) };
+	array<QuantizedChannel, 2> mid_side;
+	uint64_t lr_bits { }, ms_bits { };
+	for(int c = 0 ; c < 2 ; ++c) {
+		quantize_channel(x[c].data(), n, q, choose_predictor(x[c].data(), n, q, max_order), lr[c]);
+		lr_bits += lr[c].bits;
+		quantize_channel(ms[c].data(), n, ms_q[c], choose_predictor(ms[c].data(), n, ms_q[c], max_order), mid_side[c]);
+		ms_bits += mid_side[c].bits;
+	}
+
+	bool use_ms = ms_bits < lr_bits;
+	bs.write_n_bits(use_ms, 1);
+	for(int c = 0 ; c < 2 ; ++c)
+		if(use_ms)
+			encode_channel(bs, n, ms_q[c], mid_side[c]);
+		else
+			encode_channel(bs, n, q, lr[c]);
+}
+
+void decode_block(BitStream& bs, short* s, size_t n, int channels, int bits) {
+	ChannelQuantizer q = sample_quantizer(bits);
+	array<array<int32_t, LPC_BLOCK_FRAMES>, 2> rec;
+
+	if(channels != 2) {
+		for(int c = 0 ; c < channels ; ++c) {
+			decode_channel(bs, rec[0].data(), n, q);
+			for(size_t i = 0 ; i < n ; ++i)
+				s[i * channels + c] = rec[0][i];
+		}
+
+		return;
+	}
+
+	bool use_ms = bs.read_n_bits(1);
+	decode_channel(bs, rec[0].data(), n, use_ms ? mid_quantizer(bits) : q);
+	decode_channel(bs, rec[1].data(), n, use_ms ? side_quantizer(bits) : q);
+	for(size_t i = 0 ; i < n ; ++i) {
+		int32_t left = rec[0][i], right = rec[1][i];
+		if(use_ms)
+			from_mid_side(rec[0][i], rec[1][i], left, right);
+
+		s[2 * i] = clamp_sample(left, q);
+		s[2 * i + 1] = clamp_sample(right, q);
+	}
+}
+
+}
+
+//---------------------------------------------------------------------------------
+
+int lpc_predictors(const int32_t* x, size_t n, int max_order, LpcPredictor* predictors, double* err) {
+	predictors[0] = { };
+	err[0] = 0;
+	for(size_t i = 0 ; i < n ; ++i)
+		err[0] += (double)x[i] * x[i];
+
+	max_order = min<int>(max_order, n - 1);
+	if(max_order <= 0)
+		return 0;
+
+	vector<double> v(n + max_order);
+	copy_n(x, n, v.begin());
+
+	array<double, LPC_MAX_ORDER + 1> r;
+	array<array<double, LPC_MAX_ORDER>, LPC_MAX_ORDER + 1> a { };
+	autocorrelation(v.data(), n, max_order, r.data());
+	max_order = levinson_durbin(r.data(), max_order, a, err);
+
+	for(int p = 1 ; p <= max_order ; ++p)
+		predictors[p] = quantize_coefs(a[p], p);
+
+	return max_order;
+}
+
+void lpc_encode(BitStream& bs, span<const short> samples, int channels, int bits, int max_order) {
+	size_t frames = samples.size() / channels;
+	for(size_t f = 0 ; f < frames ; f += LPC_BLOCK_FRAMES) {
+		size_t n = min(LPC_BLOCK_FRAMES, frames - f);
+		encode_block(bs, samples.data() + f * channels, n, channels, bits, max_order);
+	}
+}
+
+void lpc_decode(BitStream& bs, span<short> samples, int channels, int bits) {
+	size_t frames = samples.size() / channels;
+	for(size_t f = 0 ; f < frames ; f += LPC_BLOCK_FRAMES) {
+		size_t n = min(LPC_BLOCK_FRAMES, frames - f);
+		decode_block(bs, samples.data() + f * channels, n, channels, bits);
+	}
+}
@@ -0,0 +1,70 @@
+//-------------------------------------------------------------------------------------------
+//
+// Predictive quantization of 16-bit samples: each block of LPC_BLOCK_FRAMES
+// frames gets, for each channel, a linear predictor (Levinson-Durbin on the
+// block's autocorrelation, of the order with the smallest estimated size up
+// to the one requested), and the prediction residual is quantized with the
+// step of a 'bits'-bit uniform quantizer. The prediction is computed from the
+// reconstructed samples (closed loop), in integer arithmetic, so the encoder
+// tracks exactly what the decoder rebuilds and errors do not accumulate.
+//
+// Block layout, for each channel:
+//
+//   order (6 bits), then, when it is not 0, shift (4 bits) and the order
+//   coefficients (16 bits each, two's complement, scaled by 2^shift)
+//   warm-up: the first order samples quantized directly, zig-zag mapped,
+//   in bits + 1 bits each
+//   k (5 bits), then the quantized residuals of the other samples, Rice coded
+//
+// Stereo blocks start with a joint stereo flag (1 bit). When it is set, the
+// channels coded are mid = (left + right) >> 1 and side = left - right, with
+// steps scaled by 1 / sqrt(2) and sqrt(2) (for the same mean squared error,
+// not the same peak error, in left and right) and warm-up samples one bit
+// wider; the encoder sets it when they take fewer bits.
+//
+// Blocks do not depend on each other, so buffers holding whole blocks can be
+// encoded separately and concatenated.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef LPC_CODEC_H
+#define LPC_CODEC_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "bit_stream.h"
+
+constexpr size_t LPC_BLOCK_FRAMES = 4096;
+constexpr int LPC_MAX_ORDER = 32;
+
+// samples holds whole frames of channels samples; 1 <= bits <= 16 and
+// 0 <= max_order <= LPC_MAX_ORDER (0 quantizes the samples directly)
+void lpc_encode(BitStream& bs, std::span<const short> samples, int channels, int bits, int max_order);
+void lpc_decode(BitStream& bs, std::span<short> samples, int channels, int bits);
+
+// Linear predictor with integer coefficients, as stored in the blocks
+struct LpcPredictor {
+	int									order { };
+	int									shift { };
+	std::array<int32_t, LPC_MAX_ORDER>	coefs { };	// coefs[j] weighs the sample j + 1 positions back
+};
+
+// Building blocks for other codecs: the predictors of orders 0 to max_order
+// for the n samples of x (Levinson-Durbin on their autocorrelation), with
+// err[p] the prediction error energy of each, returning the highest order
+// found; and the prediction of the sample following hist[-1], hist[-2], ...,
+// clamped to 16 bits
+int lpc_predictors(const int32_t* x, size_t n, int max_order, LpcPredictor* predictors, double* err);
+
+inline int32_t lpc_predict(const LpcPredictor& p, const int32_t* hist) {
+	int64_t sum { };
+	for(int j = 0 ; j < p.order ; ++j)
+		sum += (int64_t)p.coefs[j] * hist[-1 - j];
+
+	return std::clamp<int64_t>((sum + ((int64_t { 1 } << p.shift) >> 1)) >> p.shift, -32768, 32767);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#include <array>
+#include <utility>
+#include "packed_codec.h"
+
+using namespace std;
+
+namespace {
+
+template <size_t... I>
+constexpr array<PackedCodecOps, sizeof...(I)> make_table(index_sequence<I...>) {
+	return { { { PackedCodec<I + 1>::pack, PackedCodec<I + 1>::unpack }... } };
+}
+
+constexpr auto packed_codec_table = make_table(make_index_sequence<16> { });
+
+}
+
+const PackedCodecOps& packed_codec(int bits) {
+	return packed_codec_table[bits - 1];
+}
+
@@ -0,0 +1,73 @@
+//-------------------------------------------------------------------------------------------
+//
+// Fixed-width packing of quantization levels, specialized at compile time for
+// each bit width. PackedCodec<Bits> groups values into one accumulator field
+// (8 values when Bits <= 8, 4 otherwise), so every shift and mask is a
+// constant and the inner loop is fully unrolled and branch-free. The layout
+// is the same as one write_n_bits(value, Bits) call per value.
+//
+// Use packed_codec(bits) to pick the specialization once, e.g., after the
+// header of a stream has been read.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef PACKED_CODEC_H
+#define PACKED_CODEC_H
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include "bit_stream.h"
+
+template <int Bits>
+class PackedCodec {
+	static_assert(Bits >= 1 and Bits <= 16, "PackedCodec supports 1 to 16 bits");
+
+  public:
+	static constexpr int GROUP = Bits <= 8 ? 8 : 4; // Values per accumulator field
+	static constexpr uint64_t MASK = (uint64_t { 1 } << Bits) - 1;
+
+	static void pack(BitStream& bs, std::span<const uint16_t> values) {
+		const uint16_t* v = values.data();
+		size_t n = values.size() - values.size() % GROUP;
+
+		for(size_t i = 0 ; i < n ; i += GROUP)
+			bs.write_n_bits(merge(v + i, std::make_index_sequence<GROUP> { }), GROUP * Bits);
+
+		for(size_t i = n ; i < values.size() ; ++i)
+			bs.write_n_bits(v[i], Bits);
+	}
+
+	static void unpack(BitStream& bs, std::span<uint16_t> values) {
+		uint16_t* v = values.data();
+		size_t n = values.size() - values.size() % GROUP;
+
+		for(size_t i = 0 ; i < n ; i += GROUP)
+			split(bs.read_n_bits(GROUP * Bits), v + i, std::make_index_sequence<GROUP> { });
+
+		for(size_t i = n ; i < values.size() ; ++i)
+			v[i] = bs.read_n_bits(Bits);
+	}
+
+  private:
+	template <size_t... I>
+	static uint64_t merge(const uint16_t* v, std::index_sequence<I...>) {
+		return ((uint64_t { v[I] & MASK } << ((GROUP - 1 - I) * Bits)) | ...);
+	}
+
+	template <size_t... I>
+	static void split(uint64_t x, uint16_t* v, std::index_sequence<I...>) {
+		((v[I] = x >> ((GROUP - 1 - I) * Bits) & MASK), ...);
+	}
+};
+
+struct PackedCodecOps {
+	void (*pack)(BitStream& bs, std::span<const uint16_t> values);
+	void (*unpack)(BitStream& bs, std::span<uint16_t> values);
+};
+
+// Returns the PackedCodec specialization for 1 <= bits <= 16
+const PackedCodecOps& packed_codec(int bits);
+
+#endif
+
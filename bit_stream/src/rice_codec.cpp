@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include "rice_codec.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int TABLE_BITS = 12; // Lookahead of the table-driven decoder
+constexpr int TABLE_MAX_K = TABLE_BITS - 1;
+
+// Decoding of the code starting at the next TABLE_BITS bits, for a given k.
+// A length of 0 means the code is longer.
+struct RiceEntry {
+	int16_t		residual;
+	uint8_t		length;
+};
+
+using RiceTable = array<RiceEntry, 1 << TABLE_BITS>;
+
+array<RiceTable, TABLE_MAX_K + 1> make_tables() {
+	array<RiceTable, TABLE_MAX_K + 1> tables { };
+	for(int k = 0 ; k <= TABLE_MAX_K ; ++k)
+		for(uint32_t v = 0 ; v < (1u << TABLE_BITS) ; ++v) {
+			int q = countl_zero(v) - (32 - TABLE_BITS);
+			int length = q + 1 + k;
+			if(length > TABLE_BITS)
+				continue;
+
+			uint32_t u = (q << k) | ((v >> (TABLE_BITS - length)) & ((1u << k) - 1));
+			tables[k][v] = { (int16_t)unzigzag(u), (uint8_t)length };
+		}
+
+	return tables;
+}
+
+const RiceTable& rice_table(int k) {
+	static const auto tables = make_tables();
+	return tables[k];
+}
+
+//
+// Rice coding of a channel of a block: its values' residuals from center or
+// from the previous value, whichever gives the fewer bits, zig-zag mapped into
+// u. The values of level channels are levels (center being the mid level);
+// those of side channels are differences of levels (center being 0).
+//
+struct ChannelCode {
+	bool		use_prev;
+	int			k;
+	uint64_t	bits;
+};
+
+ChannelCode code_channel(const int32_t* v, size_t n, int32_t center, int max_k, uint32_t* u) {
+	array<uint32_t, RICE_BLOCK_FRAMES> from_prev;
+	int32_t prev = center;
+	for(size_t i = 0 ; i < n ; ++i) {
+		u[i] = zigzag(v[i] - center);
+		from_prev[i] = zigzag(v[i] - prev);
+		prev = v[i];
+	}
+
+	int k_center = rice_best_k(span(u, n), max_k);
+	int k_prev = rice_best_k(span(from_prev.data(), n), max_k);
+	uint64_t bits_center = rice_cost(span(u, n), k_center);
+	uint64_t bits_prev = rice_cost(span(from_prev.data(), n), k_prev);
+	if(bits_prev < bits_center) {
+		copy_n(from_prev.begin(), n, u);
+		return { true, k_prev, 6 + bits_prev };
+	}
+
+	return { false, k_center, 6 + bits_center };
+}
+
+void write_channel(BitStream& bs, const ChannelCode& code, const uint32_t* u, size_t n) {
+	bs.write_n_bits(code.use_prev, 1);
+	bs.write_n_bits(code.k, 5);
+	for(size_t i = 0 ; i < n ; ++i)
+		bs.write_rice(u[i], code.k);
+}
+
+//
+// Reads a channel written by write_channel. With a mask, the values are
+// wrapped to it, so that corrupted residuals still give valid levels.
+//
+void read_channel(BitStream& bs, int32_t* v, size_t n, int32_t center, uint32_t mask) {
+	bool use_prev = bs.read_n_bits(1);
+	int k = bs.read_n_bits(5);
+	rice_read_signed(bs, span(v, n), k);
+
+	uint32_t pred = center;
+	for(size_t i = 0 ; i < n ; ++i) {
+		uint32_t value = (pred + v[i]) & mask;
+		v[i] = value;
+		if(use_prev)
+			pred = value;
+	}
+}
+
+void pack_block(BitStream& bs, const uint16_t* levels, size_t n, int channels, int bits) {
+	int32_t mid = 1 << (bits - 1);
+	array<array<int32_t, RICE_BLOCK_FRAMES>, 2> v;
+	array<array<uint32_t, RICE_BLOCK_FRAMES>, 2> u;
+
+	if(channels != 2) {
+		for(int c = 0 ; c < channels ; ++c) {
+			for(size_t i = 0 ; i < n ; ++i)
+				v[0][i] = levels[i * channels + c];
+
+			write_channel(bs, code_channel(v[0].data(), n, mid, bits, u[0].data()), u[0].data(), n);
+		}
+
+		return;
+	}
+
+	// Stereo: the levels of both channels, or their mid and side (the side
+	// needing one bit more), whichever gives the fewer bits
+	array<array<int32_t, RICE_BLOCK_FRAMES>, 2> ms;
+	array<array<uint32_t, RICE_BLOCK_FRAMES>, 2> u_ms;
+	for(size_t i = 0 ; i < n ; ++i) {
+		v[0][i] = levels[2 * i];
+		v[1][i] = levels[2 * i + 1];
+		to_mid_side(v[0][i], v[1][i], ms[0][i], ms[1][i]);
+	}
+
+	array<ChannelCode, 2> lr_code {
+		code_channel(v[0].data(), n, mid, bits, u[0].data()),
+		code_channel(v[1].data(), n, mid, bits, u[1].data())
+	};
+	array<ChannelCode, 2> ms_code {
+		code_channel(ms[0].data(), n, mid, bits, u_ms[0].data()),
+		code_channel(ms[1].data(), n, 0, bits + 1, u_ms[1].data())
+	};
+
+	bool use_ms = ms_code[0].bits + ms_code[1].bits < lr_code[0].bits + lr_code[1].bits;
+	bs.write_n_bits(use_ms, 1);
+	for(int c = 0 ; c < 2 ; ++c)
+		if(use_ms)
+			write_channel(bs, ms_code[c], u_ms[c].data(), n);
+		else
+			write_channel(bs, lr_code[c], u[c].data(), n);
+}
+
+void unpack_block(BitStream& bs, uint16_t* levels, size_t n, int channels, int bits) {
+	int32_t mid = 1 << (bits - 1);
+	uint32_t mask = (1u << bits) - 1;
+	array<array<int32_t, RICE_BLOCK_FRAMES>, 2> v;
+
+	if(channels != 2) {
+		for(int c = 0 ; c < channels ; ++c) {
+			read_channel(bs, v[0].data(), n, mid, mask);
+			for(size_t i = 0 ; i < n ; ++i)
+				levels[i * channels + c] = v[0][i];
+		}
+
+		return;
+	}
+
+	bool use_ms = bs.read_n_bits(1);
+	read_channel(bs, v[0].data(), n, mid, mask);
+	read_channel(bs, v[1].data(), n, use_ms ? 0 : mid, use_ms ? UINT32_MAX : mask);
+	for(size_t i = 0 ; i < n ; ++i) {
+		int32_t left = v[0][i], right = v[1][i];
+		if(use_ms)
+			from_mid_side(v[0][i], v[1][i], left, right);
+
+		levels[2 * i] = left & mask;
+		levels[2 * i + 1] = right & mask;
+	}
+}
+
+}
+
+void rice_pack(BitStream& bs, span<const uint16_t> levels, int channels, int bits) {
+	size_t frames = levels.size() / channels;
+	for(size_t f = 0 ; f < frames ; f += RICE_BLOCK_FRAMES) {
+		size_t n = min(RICE_BLOCK_FRAMES, frames - f);
+		pack_block(bs, levels.data() + f * channels, n, channels, bits);
+	}
+}
+
+void rice_unpack(BitStream& bs, span<uint16_t> levels, int channels, int bits) {
+	size_t frames = levels.size() / channels;
+	for(size_t f = 0 ; f < frames ; f += RICE_BLOCK_FRAMES) {
+		size_t n = min(RICE_BLOCK_FRAMES, frames - f);
+		unpack_block(bs, levels.data() + f * channels, n, channels, bits);
+	}
+}
+
+//---------------------------------------------------------------------------------
+
+uint64_t rice_cost(span<const uint32_t> u, int k) {
+	uint64_t cost = u.size() * (k + 1);
+	for(uint32_t x : u)
+		cost += x >> k;
+
+	return cost;
+}
+
+int rice_best_k(span<const uint32_t> u, int max_k) {
+	int best { };
+	uint64_t best_cost = UINT64_MAX;
+	for(int k = 0 ; k <= max_k ; ++k) {
+		uint64_t cost = rice_cost(u, k);
+		if(cost < best_cost) {
+			best = k;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+void rice_read_signed(BitStream& bs, span<int32_t> values, int k) {
+	if(k > TABLE_MAX_K) {
+		for(int32_t& v : values)
+			v = bs.read_rice_signed(k);
+
+		return;
+	}
+
+	const RiceTable& table = rice_table(k);
+	for(int32_t& v : values) {
+		RiceEntry e = table[bs.peek_bits(TABLE_BITS)];
+		if(e.length != 0) {
+			bs.skip_bits(e.length);
+			v = e.residual;
+		}
+		else
+			v = bs.read_rice_signed(k);
+	}
+}
@@ -0,0 +1,49 @@
+//-------------------------------------------------------------------------------------------
+//
+// Block-adaptive Rice coding of quantization levels, an alternative to the
+// fixed-width PackedCodec for levels that mostly sit near the middle one or
+// change slowly. The levels (interleaved, as read from a WAV file) are coded
+// in blocks of RICE_BLOCK_FRAMES frames, each channel on its own:
+//
+//   predictor (1 bit): 0 - the mid level, 1 - the previous level (the first
+//                      one of the block is predicted by the mid level)
+//   k (5 bits):        Rice parameter, chosen for the smallest block
+//   residuals:         level - prediction, zig-zag mapped, Rice coded
+//
+// Stereo blocks start with a joint stereo flag (1 bit). When it is set, the
+// channels coded are mid = (left + right) >> 1 and side = left - right
+// instead, the side being predicted by 0 rather than the mid level; this
+// transform is reversible, so it does not change the levels decoded, and the
+// encoder sets it when it gives fewer bits.
+//
+// Blocks do not depend on each other, so buffers holding whole blocks can be
+// packed separately and concatenated. Unpacking looks the next codes up in
+// a table for the block's k, falling back to read_rice_signed for long ones.
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef RICE_CODEC_H
+#define RICE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "bit_stream.h"
+
+constexpr size_t RICE_BLOCK_FRAMES = 1024;
+
+// levels holds whole frames of channels levels of 1 <= bits <= 16 each; the
+// last block is shorter when the number of frames is not a multiple of
+// RICE_BLOCK_FRAMES
+void rice_pack(BitStream& bs, std::span<const uint16_t> levels, int channels, int bits);
+void rice_unpack(BitStream& bs, std::span<uint16_t> levels, int channels, int bits);
+
+// Building blocks for other codecs: the number of bits of the zig-zag mapped
+// values u coded with parameter k, the parameter (0 to max_k) giving the
+// fewest, and the table-driven decoding of values written with
+// write_rice_signed(value, k)
+uint64_t rice_cost(std::span<const uint32_t> u, int k);
+int rice_best_k(std::span<const uint32_t> u, int max_k);
+void rice_read_signed(BitStream& bs, std::span<int32_t> values, int k);
+
+#endif
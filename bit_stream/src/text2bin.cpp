@@ -18,10 +18,96 @@
 //
 #include <iostream>
 #include <fstream>
+#include <array>
+#include <bit>
+#include <vector>
 #include "bit_stream.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+const size_t BLOCK_SIZE = 1 << 20; // Characters read from the text file at a time
+
+//------------------------------------------------------------------------------
+//
+// Bit-reversal of a byte, used to turn movemask results (first character in
+// the least significant bit) into stream order (first character first)
+//
+constexpr array<uint8_t, 256> make_reverse_table() {
+	array<uint8_t, 256> table { };
+	for(int b = 0 ; b < 256 ; ++b)
+		for(int i = 0 ; i < 8 ; ++i)
+			table[b] |= ((b >> i) & 1) << (7 - i);
+
+	return table;
+}
+
+constexpr array<uint8_t, 256> REVERSE = make_reverse_table();
+
+//------------------------------------------------------------------------------
+//
+// Writes the characters of a block, returning false if one is invalid
+//
+bool write_chars(BitStream& obs, const char* p, size_t n) {
+	for(size_t i = 0 ; i < n ; ++i) {
+		switch(p[i]) {
+			case '0':
+				obs.write_bit(0);
+				break;
+			case '1':
+				obs.write_bit(1);
+				break;
+			case '\n':
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+//
+// Sixteen characters are classified at a time. Each run of '0'/'1' between
+// newlines becomes one write_n_bits; the common case, no newline at all, is a
+// single 16-bit write.
+//
+bool write_block(BitStream& obs, const char* p, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i one = _mm_set1_epi8('1');
+	const __m128i newline = _mm_set1_epi8('\n');
+	for( ; i + 16 <= n ; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+		__m128i is_one = _mm_cmpeq_epi8(x, one);
+		unsigned ones = _mm_movemask_epi8(is_one);
+		unsigned bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, zero), is_one));
+		if(bits == 0xffff) {
+			obs.write_n_bits(REVERSE[ones & 0xff] << 8 | REVERSE[ones >> 8], 16);
+			continue;
+		}
+
+		if((bits | _mm_movemask_epi8(_mm_cmpeq_epi8(x, newline))) != 0xffff)
+			return false;
+
+		while(bits != 0) {
+			int start = countr_zero(bits);
+			int len = countr_one(bits >> start);
+			unsigned run = (ones >> start) & ((1u << len) - 1);
+			obs.write_n_bits((REVERSE[run & 0xff] << 8 | REVERSE[run >> 8]) >> (16 - len), len);
+			bits &= ~(((1u << len) - 1) << start);
+		}
+	}
+#endif
+
+	return write_chars(obs, p + i, n - i);
+}
+
 //------------------------------------------------------------------------------
 
 int main(int argc, char* argv[]) {
@@ -45,25 +131,18 @@ int main(int argc, char* argv[]) {
 
 	BitStream obs { ofs, STREAM_WRITE };
 
-	char c;
-	while(ifs.get(c)) {
-		switch(c) {
-			case '0':
-				obs.write_bit(0);
-				break;
-			case '1':
-				obs.write_bit(1);
-				break;
-			case '\n':
-				break;
-			default:
-				cerr << "Error: found invalid char\n";
-				return 1;
+	vector<char> block(BLOCK_SIZE);
+	while(ifs.read(block.data(), block.size()) or ifs.gcount() > 0) {
+		if(not write_block(obs, block.data(), ifs.gcount())) {
+			cerr << "Error: found invalid char\n";
+			return 1;
 		}
 	}
 
-	obs.close();
+	if(not obs.close()) {
+		cerr << "Error writing bin file " << argv[argc-1] << endl;
+		return 1;
+	}
 
 	return 0;
 }
-
@@ -0,0 +1,324 @@
+//-------------------------------------------------------------------------------------------
+//
+// io_uring engine (see uring_engine.h). The submission and completion rings
+// are shared with the kernel: tails/heads are published with release stores
+// and read with acquire loads, as io_uring requires.
+//
+//-------------------------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "uring_engine.h"
+
+using namespace std;
+
+namespace {
+
+int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+#ifdef __NR_io_uring_setup
+	return syscall(__NR_io_uring_setup, entries, params);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+int sys_io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned n_args) {
+	return syscall(__NR_io_uring_register, ring_fd, opcode, arg, n_args);
+}
+
+}
+
+//-------------------------------------------------------------------------------------------
+//
+// Reading starts right away, with every buffer in flight. Writing starts at
+// the descriptor's current position, which finish() moves past the data.
+//
+UringEngine::UringEngine(int fd, bool rw_status, int n_buffers, size_t buffer_size) : m_fd { fd },
+  m_rw_status { rw_status }, m_buffer_size { buffer_size } {
+	m_offset = lseek(m_fd, 0, SEEK_CUR);
+	if(m_offset < 0 or n_buffers < 1 or not setup(n_buffers))
+		return;
+
+	for(int i = 0 ; i < n_buffers ; ++i) {
+		m_buffers.push_back(make_aligned_buffer(m_buffer_size));
+		m_requests.push_back({ });
+	}
+
+	// Registered buffers save the kernel from pinning the pages on every
+	// request; without them (e.g., a low RLIMIT_MEMLOCK) plain requests are used
+	vector<iovec> iov;
+	for(auto& buf : m_buffers)
+		iov.push_back({ buf.get(), m_buffer_size });
+
+	m_fixed = sys_io_uring_register(m_ring_fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) == 0;
+
+	if(m_rw_status)
+		seek(m_offset);
+}
+
+UringEngine::~UringEngine() {
+	if(m_ring_fd >= 0)
+		wait_all(); // The kernel may still be using the buffers
+
+	if(m_sqes != nullptr)
+		munmap(m_sqes, m_sqes_size);
+
+	if(m_cq_map != nullptr and m_cq_map != m_sq_map)
+		munmap(m_cq_map, m_cq_map_size);
+
+	if(m_sq_map != nullptr)
+		munmap(m_sq_map, m_sq_map_size);
+
+	if(m_ring_fd >= 0)
+		close(m_ring_fd);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Creates the ring and maps its queues. On any failure the engine is left
+// closed, and the destructor releases what was set up.
+//
+bool UringEngine::setup(int n_buffers) {
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int ring_fd = sys_io_uring_setup(n_buffers, &params);
+	if(ring_fd < 0)
+		return false;
+
+	m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		m_sq_map_size = m_cq_map_size = max(m_sq_map_size, m_cq_map_size);
+
+	void* map = mmap(nullptr, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+	  IORING_OFF_SQ_RING);
+	m_sq_map = map != MAP_FAILED ? map : nullptr;
+
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		m_cq_map = m_sq_map;
+	else {
+		map = mmap(nullptr, m_cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+		  IORING_OFF_CQ_RING);
+		m_cq_map = map != MAP_FAILED ? map : nullptr;
+	}
+
+	m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	map = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	m_sqes = map != MAP_FAILED ? (io_uring_sqe*)map : nullptr;
+
+	if(m_sq_map == nullptr or m_cq_map == nullptr or m_sqes == nullptr) {
+		close(ring_fd);
+		return false;
+	}
+
+	uint8_t* sq = (uint8_t*)m_sq_map;
+	m_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	m_sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	m_sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	uint8_t* cq = (uint8_t*)m_cq_map;
+	m_cq_head = (unsigned*)(cq + params.cq_off.head);
+	m_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	m_cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	m_ring_fd = ring_fd;
+	return true;
+}
+
+//---------------------------------------------------------------------------------
+//
+// Submits the part of request i not transferred yet. There are never more
+// requests in flight than buffers, so the submission queue is never full.
+// After an error, or if the submission fails, the request is not in flight.
+//
+void UringEngine::queue(int i) {
+	Request& req = m_requests[i];
+	req.in_flight = false;
+	if(m_error)
+		return;
+
+	unsigned tail = *m_sq_tail;
+	unsigned index = tail & *m_sq_mask;
+	io_uring_sqe& sqe = m_sqes[index];
+	memset(&sqe, 0, sizeof(sqe));
+	if(m_fixed) {
+		sqe.opcode = m_rw_status ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe.buf_index = i;
+	}
+	else
+		sqe.opcode = m_rw_status ? IORING_OP_READ : IORING_OP_WRITE;
+
+	sqe.fd = m_fd;
+	sqe.addr = (uint64_t)(m_buffers[i].get() + req.done);
+	sqe.len = req.size - req.done;
+	sqe.off = req.offset + req.done;
+	sqe.user_data = i;
+	m_sq_array[index] = index;
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	int ret;
+	while((ret = sys_io_uring_enter(m_ring_fd, 1, 0, 0)) < 0 and errno == EINTR)
+		;
+
+	if(ret < 0)
+		m_error = true;
+	else
+		req.in_flight = true;
+}
+
+//
+// Handles the completions available. Short transfers are resubmitted for the
+// rest, so a request only ends when it is complete, at the end of the file
+// (reading) or on an error, which is sticky: no request is queued after it.
+// A write transferring nothing is an error too.
+//
+void UringEngine::reap() {
+	unsigned head = *m_cq_head;
+	unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+	for( ; head != tail ; ++head) {
+		const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+		int i = cqe.user_data;
+		Request& req = m_requests[i];
+		int res = cqe.res;
+		__atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+		if(res == -EINTR or res == -EAGAIN)
+			queue(i);
+		else if(res <= 0) {
+			if(res < 0 or not m_rw_status)
+				m_error = true;
+
+			req.in_flight = false;
+		}
+		else {
+			req.done += res;
+			if(req.done < req.size)
+				queue(i);
+			else
+				req.in_flight = false;
+		}
+	}
+}
+
+//
+// Waits for a completion. If the ring itself fails, no completion can be
+// waited for: the requests still in flight are given up, as an error.
+//
+void UringEngine::wait() {
+	int ret;
+	while((ret = sys_io_uring_enter(m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS)) < 0 and errno == EINTR)
+		;
+
+	reap();
+	if(ret < 0) {
+		m_error = true;
+		for(auto& req : m_requests)
+			req.in_flight = false;
+	}
+}
+
+void UringEngine::wait_all() {
+	reap();
+	for(size_t i = 0 ; i < m_requests.size() ; ++i)
+		while(m_requests[i].in_flight)
+			wait();
+}
+
+//---------------------------------------------------------------------------------
+//
+// Writing: the caller always holds one buffer, the last one returned
+//
+int UringEngine::free_buffer() const {
+	for(size_t i = 0 ; i < m_requests.size() ; ++i)
+		if(not m_requests[i].in_flight)
+			return i;
+
+	return -1;
+}
+
+uint8_t* UringEngine::buffer() {
+	return m_buffers[0].get();
+}
+
+uint8_t* UringEngine::submit(uint8_t* buf, size_t n) {
+	int i = 0;
+	while(m_buffers[i].get() != buf)
+		++i;
+
+	m_requests[i] = { m_offset, n, 0, false };
+	m_offset += n;
+	queue(i);
+
+	reap();
+	int next = free_buffer();
+	if(next < 0) {
+		m_waits++;
+		while((next = free_buffer()) < 0)
+			wait();
+	}
+
+	return m_buffers[next].get();
+}
+
+void UringEngine::finish() {
+	wait_all();
+	lseek(m_fd, m_offset, SEEK_SET);
+}
+
+//---------------------------------------------------------------------------------
+//
+// Reading: the buffer handed out before goes to the back of the queue, to be
+// filled with the data following the last buffer in flight
+//
+uint8_t* UringEngine::next(size_t& n) {
+	if(m_current >= 0 and not m_eof) {
+		m_requests[m_current] = { m_offset, m_buffer_size, 0, false };
+		m_offset += m_buffer_size;
+		queue(m_current);
+		m_order.push_back(m_current);
+	}
+
+	m_current = -1;
+	n = 0;
+	if(m_order.empty())
+		return m_buffers[0].get();
+
+	m_current = m_order.front();
+	m_order.pop_front();
+	while(m_requests[m_current].in_flight)
+		wait();
+
+	n = m_requests[m_current].done;
+	if(n < m_buffer_size)
+		m_eof = true;
+
+	return m_buffers[m_current].get();
+}
+
+void UringEngine::seek(off_t pos) {
+	wait_all();
+	m_order.clear();
+	m_current = -1;
+	m_eof = false;
+	m_offset = pos;
+
+	for(size_t i = 0 ; i < m_buffers.size() ; ++i) {
+		m_requests[i] = { m_offset, m_buffer_size, 0, false };
+		m_offset += m_buffer_size;
+		queue(i);
+		m_order.push_back(i);
+	}
+}
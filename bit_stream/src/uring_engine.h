@@ -0,0 +1,99 @@
+//-------------------------------------------------------------------------------------------
+//
+// io_uring I/O engine for ByteStream on regular files. It owns the buffers,
+// registered with the kernel so that they are not mapped again on every
+// request, and keeps several of them in flight at consecutive file offsets:
+// when writing, full buffers are queued while the caller fills a free one;
+// when reading, the buffers following the one being consumed are being filled.
+// There is no helper thread: completions are collected whenever the caller
+// needs a buffer. The system calls are used directly (liburing is not needed).
+//
+//-------------------------------------------------------------------------------------------
+
+#ifndef URING_ENGINE_H
+#define URING_ENGINE_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include "aligned_buffer.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+class UringEngine {
+  private:
+	struct Request {
+		off_t		offset;		// File offset of the buffer's first byte
+		size_t		size;		// Bytes to transfer
+		size_t		done;		// Bytes transferred so far
+		bool		in_flight;
+	};
+
+	int							m_fd;
+	bool						m_rw_status;
+	size_t						m_buffer_size;
+	std::vector<AlignedBuffer>	m_buffers;
+	std::vector<Request>		m_requests;		// One per buffer
+	std::deque<int>				m_order;		// Reading: buffers being filled, in file order
+	int							m_current { -1 };	// Reading: buffer handed to the caller
+	off_t						m_offset { };	// Next file offset to read or write
+	bool						m_eof { };
+	bool						m_error { };	// A request failed (sticky)
+	bool						m_fixed { };	// Buffers registered with the kernel
+	uint64_t					m_waits { };
+
+	int				m_ring_fd { -1 };
+	void*			m_sq_map { };
+	size_t			m_sq_map_size { };
+	void*			m_cq_map { };
+	size_t			m_cq_map_size { };
+	io_uring_sqe*	m_sqes { };
+	size_t			m_sqes_size { };
+	unsigned*		m_sq_tail { };
+	unsigned*		m_sq_mask { };
+	unsigned*		m_sq_array { };
+	unsigned*		m_cq_head { };
+	unsigned*		m_cq_tail { };
+	unsigned*		m_cq_mask { };
+	io_uring_cqe*	m_cqes { };
+
+	bool setup(int n_buffers);
+	void queue(int i);
+	void reap();
+	void wait();
+	void wait_all();
+	int free_buffer() const;
+
+  public:
+	// Check is_open(): the engine is not available when the kernel has no
+	// io_uring (or it is disabled, e.g., by a container's seccomp profile)
+	UringEngine(int fd, bool rw_status, int n_buffers, size_t buffer_size);
+	~UringEngine();
+
+	UringEngine() = delete;
+	UringEngine(const UringEngine&) = delete;
+	UringEngine& operator=(const UringEngine&) = delete;
+
+	bool is_open() const { return m_ring_fd >= 0; }
+
+	// Writing: buffer() is the caller's first buffer; submit() queues the first
+	// n bytes of buf and returns a free buffer; finish() waits for all writes
+	uint8_t* buffer();
+	uint8_t* submit(uint8_t* buf, size_t n);
+	void finish();
+	uint64_t waits() const { return m_waits; }
+
+	// Some request failed (or the ring did): its data, and any after it, is
+	// missing. Reading, next() then reports the end of the file.
+	bool error() const { return m_error; }
+
+	// Reading: next() returns the following buffer of the file, holding n
+	// bytes (0 at the end of the file), and recycles the previous one to read
+	// further ahead; seek() restarts reading at pos
+	uint8_t* next(size_t& n);
+	void seek(off_t pos);
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <sndfile.hh>
@@ -9,17 +10,67 @@
 
 using namespace std;
 
+constexpr uint64_t HEADER_BITS = 32 + 64 + 16 + 16 + 8; // samplerate, frames, blockSize, numCoeffs, quantBits
+constexpr int HEADER_FLAG_CRC = 0x80; // In the quantBits field: the file ends with a CRC32C trailer
+constexpr int HEADER_FLAG_STEREO = 0x40; // In the quantBits field: two channels, coded jointly per block
+
 // DCT-based lossy audio decoder
 // Reconstructs audio from DCT coefficients
 
+// Read a scale factor written as float (32 bits)
+double readScale(BitStream& bs) {
+    uint32_t scaleBits = bs.read_n_bits(32);
+    float scaleFloat;
+    memcpy(&scaleFloat, &scaleBits, sizeof(float));
+    return (double)scaleFloat;
+}
+
+// Read and dequantize 'bits'-bit levels over [-scale, scale]
+void readLevels(BitStream& bs, double* coeffs, size_t numCoeffs, double scale, int bits) {
+    int maxLevel = (1 << bits) - 1;
+    for (size_t i = 0; i < numCoeffs; i++) {
+        int level = bs.read_n_bits(bits);
+        
+        // Map from [0, maxLevel] to [-1, 1]
+        double normalized = (level * 2.0 / maxLevel) - 1.0;
+        
+        // Scale back
+        coeffs[i] = normalized * scale;
+    }
+}
+
+// Read a block of a stereo file (see wav_dct_enc): the coefficients of left
+// and right, from themselves or from mid and side
+void readStereoBlock(BitStream& bs, vector<vector<double>>& channelCoeffs, size_t numCoeffs) {
+    bool midSide = bs.read_n_bits(1);
+    for (auto& coeffs : channelCoeffs) {
+        double scale = readScale(bs);
+        int bits = bs.read_n_bits(4) + 1;
+        readLevels(bs, coeffs.data(), numCoeffs, scale, bits);
+    }
+    
+    if (midSide) {
+        for (size_t i = 0; i < numCoeffs; i++) {
+            double mid = channelCoeffs[0][i], side = channelCoeffs[1][i];
+            channelCoeffs[0][i] = mid + side;
+            channelCoeffs[1][i] = mid - side;
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
     bool verbose = false;
+    double startTime = 0.0; // Seconds to skip at the beginning
     
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " [-v] input.dct output.wav\n";
+        cerr << "Usage: " << argv[0] << " [-v] [-s start] input.dct output.wav\n";
         cerr << "DCT-based lossy audio codec decoder.\n";
         cerr << "\nOptions:\n";
         cerr << "  -v              Verbose output\n";
+        cerr << "  -s start        Start decoding at this time, in seconds, rounded down\n";
+        cerr << "                  to a block boundary (default: 0)\n";
+        cerr << "\nThe file checksum, if present, is verified when decoding from the start.\n";
+        cerr << "Use - as input.dct or output.wav to read from stdin or write to stdout.\n";
         cerr << "\nExample:\n";
         cerr << "  " << argv[0] << " compressed.dct output.wav\n";
         return 1;
@@ -31,6 +82,17 @@ int main(int argc, char *argv[]) {
     for (int n = 1; n < argc; n++) {
         if (string(argv[n]) == "-v") {
             verbose = true;
+        } else if (string(argv[n]) == "-s") {
+            if (n + 1 < argc) {
+                startTime = atof(argv[++n]);
+                if (startTime < 0.0) {
+                    cerr << "Error: start time must not be negative\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -s option requires a value\n";
+                return 1;
+            }
         } else if (inputFile.empty()) {
             inputFile = argv[n];
         } else if (outputFile.empty()) {
@@ -43,15 +105,18 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    // Open input binary file
-    fstream fsIn(inputFile, ios::in | ios::binary);
-    if (!fsIn.is_open()) {
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    
+    // Open input binary file for reading (memory-mapped when it is a regular file)
+    BitStream bs(inputFile, STREAM_READ);
+    if (!bs.is_open()) {
         cerr << "Error: cannot open input file '" << inputFile << "'\n";
         return 1;
     }
-    
-    // Create BitStream for reading
-    BitStream bs(fsIn, STREAM_READ);
+    bs.enable_crc();
     
     // Read header
     int samplerate = bs.read_n_bits(32);
@@ -59,8 +124,16 @@ int main(int argc, char *argv[]) {
     size_t blockSize = bs.read_n_bits(16);
     size_t numCoeffs = bs.read_n_bits(16);
     int quantBits = bs.read_n_bits(8);
+    bool hasCrc = quantBits & HEADER_FLAG_CRC;
+    int channels = quantBits & HEADER_FLAG_STEREO ? 2 : 1;
+    quantBits &= ~(HEADER_FLAG_CRC | HEADER_FLAG_STEREO);
     
     // Validate header
+    if (bs.overrun()) {
+        cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+        return 1;
+    }
+    
     if (samplerate < 1000 || samplerate > 192000) {
         cerr << "Error: invalid sample rate (" << samplerate << ") in header\n";
         return 1;
@@ -81,25 +154,41 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // Every mono block takes a fixed number of bits (scale factor + coefficients),
+    // so decoding can start at any block by seeking straight to its bit offset.
+    // Stereo blocks vary in size: they are decoded from the start, and the
+    // blocks before startBlock are dropped.
+    uint64_t blockBits = 32 + numCoeffs * quantBits;
+    sf_count_t startBlock = min((sf_count_t)(startTime * samplerate), frames) / blockSize;
+    if (startBlock > 0 && channels == 1 && !bs.seek_bit(HEADER_BITS + startBlock * blockBits)) {
+        cerr << "Error: cannot seek to block " << startBlock << "\n";
+        return 1;
+    }
+    
     if (verbose) {
         cout << "=== DCT Audio Decoder ===\n";
         cout << "Input file: " << inputFile << "\n";
         cout << "Output file: " << outputFile << "\n";
+        cout << "Channels: " << channels << "\n";
         cout << "Sample rate: " << samplerate << " Hz\n";
         cout << "Total frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
         cout << "Block size: " << blockSize << " samples\n";
         cout << "Coefficients per block: " << numCoeffs << "\n";
         cout << "Quantization bits: " << quantBits << "\n";
+        if (startBlock > 0) {
+            cout << "Start block: " << startBlock << " (" << (double)(startBlock * blockSize) / samplerate << " seconds)\n";
+        }
         
         double compressionRatio = (double)(blockSize * 16) / (numCoeffs * quantBits);
-        cout << "Compression ratio: " << compressionRatio << ":1\n";
+        cout << "Compression ratio: " << compressionRatio << ":1"
+             << (channels == 2 ? " (or better, for mid/side blocks)" : "") << "\n";
         cout << "\nDecoding...\n";
     }
     
     // Open output WAV file
     SndfileHandle sfhOut { outputFile, SFM_WRITE, 
                           SF_FORMAT_WAV | SF_FORMAT_PCM_16,
-                          1, samplerate };  // Mono output
+                          channels, samplerate };
     
     if (sfhOut.error()) {
         cerr << "Error: cannot create output file '" << outputFile << "'\n";
@@ -116,63 +205,69 @@ int main(int argc, char *argv[]) {
                                           FFTW_REDFT01, FFTW_ESTIMATE);
     
     // Process blocks
-    vector<short> samples(blockSize);
+    vector<short> samples(blockSize * channels);
+    vector<vector<double>> channelCoeffs(channels, vector<double>(numCoeffs));
     size_t totalBlocks = 0;
-    sf_count_t framesProcessed = 0;
-    int maxLevel = (1 << quantBits) - 1;
+    sf_count_t framesProcessed = channels == 1 ? startBlock * blockSize : 0;
     
     while (framesProcessed < frames) {
-        // Read scaling factor
-        uint32_t maxBits = bs.read_n_bits(32);
-        float maxCoeffFloat;
-        memcpy(&maxCoeffFloat, &maxBits, sizeof(float));
-        double maxCoeff = (double)maxCoeffFloat;
-        
-        // Initialize coefficients to zero
-        for (size_t i = 0; i < blockSize; i++) {
-            dctCoeffs[i] = 0.0;
-        }
-        
-        // Read and dequantize coefficients
-        for (size_t i = 0; i < numCoeffs; i++) {
-            int level = bs.read_n_bits(quantBits);
-            
-            // Map from [0, maxLevel] to [-1, 1]
-            double normalized = (level * 2.0 / maxLevel) - 1.0;
-            
-            // Scale back
-            dctCoeffs[i] = normalized * maxCoeff;
+        if (channels == 2) {
+            readStereoBlock(bs, channelCoeffs, numCoeffs);
+        } else {
+            // Read scaling factor, then read and dequantize coefficients
+            double maxCoeff = readScale(bs);
+            readLevels(bs, channelCoeffs[0].data(), numCoeffs, maxCoeff, quantBits);
         }
         
-        // Denormalize coefficients before inverse DCT
-        // Undo the normalization that was applied after forward DCT
-        dctCoeffs[0] /= sqrt(1.0 / blockSize);
-        double norm = sqrt(2.0 / blockSize);
-        for (size_t i = 1; i < numCoeffs; i++) {
-            dctCoeffs[i] /= norm;
+        // Past the end of the input the fields read are zeros
+        if (bs.overrun()) {
+            cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+            return 1;
         }
         
-        // Perform inverse DCT
-        fftw_execute(idctPlan);
-        
-        // Scale the inverse DCT output
-        // FFTW's REDFT01 needs to be scaled by 2*N
-        double idctScale = 2.0 * blockSize;
-        
-        // Convert to 16-bit samples
         size_t framesToWrite = blockSize;
         if (framesProcessed + framesToWrite > frames) {
             framesToWrite = frames - framesProcessed;
         }
         
-        for (size_t i = 0; i < framesToWrite; i++) {
-            // Scale back, denormalize and clamp
-            double sample = (audioBlock[i] / idctScale) * 32768.0;
+        // Stereo blocks before the start one are only read
+        if (framesProcessed < startBlock * (sf_count_t)blockSize) {
+            framesProcessed += framesToWrite;
+            continue;
+        }
+        
+        for (int c = 0; c < channels; c++) {
+            // Initialize coefficients to zero
+            for (size_t i = 0; i < blockSize; i++) {
+                dctCoeffs[i] = 0.0;
+            }
+            copy(channelCoeffs[c].begin(), channelCoeffs[c].end(), dctCoeffs);
             
-            if (sample > 32767.0) sample = 32767.0;
-            if (sample < -32768.0) sample = -32768.0;
+            // Denormalize coefficients before inverse DCT
+            // Undo the normalization that was applied after forward DCT
+            dctCoeffs[0] /= sqrt(1.0 / blockSize);
+            double norm = sqrt(2.0 / blockSize);
+            for (size_t i = 1; i < numCoeffs; i++) {
+                dctCoeffs[i] /= norm;
+            }
             
-            samples[i] = (short)round(sample);
+            // Perform inverse DCT
+            fftw_execute(idctPlan);
+            
+            // Scale the inverse DCT output
+            // FFTW's REDFT01 needs to be scaled by 2*N
+            double idctScale = 2.0 * blockSize;
+            
+            // Convert to 16-bit samples
+            for (size_t i = 0; i < framesToWrite; i++) {
+                // Scale back, denormalize and clamp
+                double sample = (audioBlock[i] / idctScale) * 32768.0;
+                
+                if (sample > 32767.0) sample = 32767.0;
+                if (sample < -32768.0) sample = -32768.0;
+                
+                samples[i * channels + c] = (short)round(sample);
+            }
         }
         
         // Write to output file
@@ -192,12 +287,20 @@ int main(int argc, char *argv[]) {
     fftw_free(dctCoeffs);
     fftw_free(audioBlock);
     
+    // The checksum covers the whole file, so it is only verified when it is
+    // read from the start
+    bool crcChecked = hasCrc && (startBlock == 0 || channels == 2);
+    if (crcChecked && !bs.check_crc()) {
+        cerr << "Error: checksum mismatch, the input file is corrupted\n";
+        return 1;
+    }
+    
     bs.close();
-    fsIn.close();
     
     if (verbose) {
         cout << "\nDecoding complete!\n";
         cout << "Total blocks decoded: " << totalBlocks << "\n";
+        cout << "Checksum: " << (crcChecked ? "OK" : "not checked") << "\n";
         cout << "Total frames written: " << framesProcessed << "\n";
         cout << "Output file created: " << outputFile << "\n";
     }
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <sndfile.hh>
@@ -9,9 +10,150 @@
 
 using namespace std;
 
+constexpr int HEADER_FLAG_CRC = 0x80; // In the quantBits field: the file ends with a CRC32C trailer
+constexpr int HEADER_FLAG_STEREO = 0x40; // In the quantBits field: two channels, coded jointly per block
+
 // DCT-based lossy audio encoder
 // Uses block-based DCT transformation with quantization and bit-packing
 
+// Quantize a coefficient to a level in [0, maxLevel], over [-scale, scale]
+int quantizeLevel(double coeff, double scale, int maxLevel) {
+    // Normalize to [-1, 1] and quantize
+    double normalized = scale > 0.0 ? coeff / scale : 0.0;
+    
+    // Map to [0, maxLevel]
+    int level = (int)round((normalized + 1.0) * maxLevel / 2.0);
+    
+    // Clamp
+    if (level < 0) level = 0;
+    if (level > maxLevel) level = maxLevel;
+    
+    return level;
+}
+
+// Quantize the coefficients to 'bits'-bit levels over [-scale, scale] and write them
+void writeLevels(BitStream& bs, const double* coeffs, size_t numCoeffs, double scale, int bits) {
+    int maxLevel = (1 << bits) - 1;
+    for (size_t i = 0; i < numCoeffs; i++) {
+        bs.write_n_bits(quantizeLevel(coeffs[i], scale, maxLevel), bits);
+    }
+}
+
+// Write a scale factor as float (32 bits)
+void writeScale(BitStream& bs, double scale) {
+    uint32_t scaleBits;
+    float scaleFloat = (float)scale;  // Convert to float explicitly
+    memcpy(&scaleBits, &scaleFloat, sizeof(float));
+    bs.write_n_bits(scaleBits, 32);
+}
+
+double maxAbs(const vector<double>& coeffs, size_t numCoeffs) {
+    double maxCoeff = 0.0;
+    for (size_t i = 0; i < numCoeffs; i++) {
+        maxCoeff = max(maxCoeff, fabs(coeffs[i]));
+    }
+    
+    return maxCoeff;
+}
+
+// Scale factor of a channel of a stereo block (0 for silence)
+double channelScale(const vector<double>& coeffs, size_t numCoeffs) {
+    double scale = maxAbs(coeffs, numCoeffs);
+    return scale < 1e-10 ? 0.0 : scale;
+}
+
+// The coefficients as the decoder rebuilds them from 'bits'-bit levels (with
+// the scale factor rounded to float, as written)
+vector<double> dequantized(const vector<double>& coeffs, size_t numCoeffs, int bits) {
+    double scale = channelScale(coeffs, numCoeffs);
+    double written = (float)scale;
+    int maxLevel = (1 << bits) - 1;
+    vector<double> rebuilt(numCoeffs);
+    for (size_t i = 0; i < numCoeffs; i++) {
+        int level = quantizeLevel(coeffs[i], scale, maxLevel);
+        rebuilt[i] = (level * 2.0 / maxLevel - 1.0) * written;
+    }
+    
+    return rebuilt;
+}
+
+double squaredError(const vector<double>& coeffs, const vector<double>& rebuilt, size_t numCoeffs) {
+    double error = 0.0;
+    for (size_t i = 0; i < numCoeffs; i++) {
+        error += (coeffs[i] - rebuilt[i]) * (coeffs[i] - rebuilt[i]);
+    }
+    
+    return error;
+}
+
+// Write a channel of a stereo block: scale factor (32 bits, 0 for silence),
+// bits - 1 (4 bits), then the levels
+void writeChannel(BitStream& bs, const vector<double>& coeffs, size_t numCoeffs, int bits) {
+    double scale = channelScale(coeffs, numCoeffs);
+    writeScale(bs, scale);
+    bs.write_n_bits(bits - 1, 4);
+    writeLevels(bs, coeffs.data(), numCoeffs, scale, bits);
+}
+
+// Write a block of a stereo file: a joint stereo flag (1 bit), then left and
+// right with quantBits bits each or, when it takes fewer bits for the same
+// mean squared error in left and in right, mid = (left + right) / 2 and
+// side = (left - right) / 2. As left = mid + side and right = mid - side, the
+// errors of mid and side add up in both; the widths of mid and side are
+// chosen by the errors of the coefficients as decoded, not by their steps,
+// since the levels have no zero and the small coefficients of a side channel
+// take an error of half a step. Returns the flag.
+bool writeStereoBlock(BitStream& bs, const vector<double>& left, const vector<double>& right,
+                      size_t numCoeffs, int quantBits) {
+    vector<double> mid(numCoeffs), side(numCoeffs);
+    for (size_t i = 0; i < numCoeffs; i++) {
+        mid[i] = (left[i] + right[i]) / 2.0;
+        side[i] = (left[i] - right[i]) / 2.0;
+    }
+    
+    double leftError = squaredError(left, dequantized(left, numCoeffs, quantBits), numCoeffs);
+    double rightError = squaredError(right, dequantized(right, numCoeffs, quantBits), numCoeffs);
+    
+    // Mid and side as decoded with every width, then the widths with the
+    // fewest bits in all (below 2 * quantBits) and no more error in left or right
+    vector<vector<double>> midRebuilt(17), sideRebuilt(17);
+    for (int bits = 1; bits <= 16; bits++) {
+        midRebuilt[bits] = dequantized(mid, numCoeffs, bits);
+        sideRebuilt[bits] = dequantized(side, numCoeffs, bits);
+    }
+    
+    int midBits = 0, sideBits = 0;
+    for (int total = 2; total < 2 * quantBits && midBits == 0; total++) {
+        for (int m = max(1, total - 16); m <= min(16, total - 1) && midBits == 0; m++) {
+            const vector<double>& midQ = midRebuilt[m];
+            const vector<double>& sideQ = sideRebuilt[total - m];
+            double midSideLeftError = 0.0, midSideRightError = 0.0;
+            for (size_t i = 0; i < numCoeffs; i++) {
+                double l = midQ[i] + sideQ[i] - left[i];
+                double r = midQ[i] - sideQ[i] - right[i];
+                midSideLeftError += l * l;
+                midSideRightError += r * r;
+            }
+            if (midSideLeftError <= leftError && midSideRightError <= rightError) {
+                midBits = m;
+                sideBits = total - m;
+            }
+        }
+    }
+    bool midSide = midBits > 0;
+    
+    bs.write_n_bits(midSide, 1);
+    if (midSide) {
+        writeChannel(bs, mid, numCoeffs, midBits);
+        writeChannel(bs, side, numCoeffs, sideBits);
+    } else {
+        writeChannel(bs, left, numCoeffs, quantBits);
+        writeChannel(bs, right, numCoeffs, quantBits);
+    }
+    
+    return midSide;
+}
+
 int main(int argc, char *argv[]) {
     bool verbose = false;
     size_t blockSize = 1024;      // DCT block size
@@ -20,13 +162,16 @@ int main(int argc, char *argv[]) {
     
     if (argc < 3) {
         cerr << "Usage: " << argv[0] << " [-v] [-bs blockSize] [-frac fraction] [-qbits bits] input.wav output.dct\n";
-        cerr << "DCT-based lossy audio codec encoder for mono audio.\n";
+        cerr << "DCT-based lossy audio codec encoder for mono and stereo audio.\n";
         cerr << "\nOptions:\n";
         cerr << "  -v              Verbose output\n";
         cerr << "  -bs blockSize   DCT block size (default: 1024)\n";
         cerr << "  -frac fraction  Fraction of DCT coefficients to keep (default: 0.2)\n";
         cerr << "  -qbits bits     Bits for coefficient quantization (default: 8)\n";
-        cerr << "\nNote: Input must be mono (single channel) WAV file.\n";
+        cerr << "\nNote: Input must be a mono or stereo WAV file. Every block of a stereo file is\n";
+        cerr << "coded as left/right or as mid/side, whichever takes fewer bits for the same\n";
+        cerr << "mean squared error (SNR) in each channel.\n";
+        cerr << "Use - as input.wav or output.dct to read from stdin or write to stdout.\n";
         cerr << "\nExample:\n";
         cerr << "  " << argv[0] << " -bs 1024 -frac 0.15 -qbits 8 input.wav output.dct\n";
         return 1;
@@ -74,6 +219,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    
     // Open input WAV file
     SndfileHandle sfhIn { inputFile };
     if (sfhIn.error()) {
@@ -93,11 +243,12 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    if (sfhIn.channels() != 1) {
-        cerr << "Error: input file must be mono (1 channel), found " << sfhIn.channels() << " channels\n";
+    if (sfhIn.channels() != 1 && sfhIn.channels() != 2) {
+        cerr << "Error: input file must be mono or stereo, found " << sfhIn.channels() << " channels\n";
         return 1;
     }
     
+    int channels = sfhIn.channels();
     int samplerate = sfhIn.samplerate();
     sf_count_t frames = sfhIn.frames();
     
@@ -109,6 +260,7 @@ int main(int argc, char *argv[]) {
         cout << "=== DCT Audio Encoder ===\n";
         cout << "Input file: " << inputFile << "\n";
         cout << "Output file: " << outputFile << "\n";
+        cout << "Channels: " << channels << "\n";
         cout << "Sample rate: " << samplerate << " Hz\n";
         cout << "Total frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
         cout << "Block size: " << blockSize << " samples\n";
@@ -116,27 +268,26 @@ int main(int argc, char *argv[]) {
         cout << "Quantization bits: " << quantBits << "\n";
         
         double compressionRatio = (double)(blockSize * 16) / (numCoeffs * quantBits);
-        cout << "Expected compression ratio: " << compressionRatio << ":1\n";
+        cout << "Expected compression ratio: " << compressionRatio << ":1"
+             << (channels == 2 ? " (or better, for mid/side blocks)" : "") << "\n";
         cout << "\nEncoding...\n";
     }
     
-    // Open output binary file
-    fstream fsOut(outputFile, ios::out | ios::binary);
-    if (!fsOut.is_open()) {
+    // Open output binary file (or stdout)
+    BitStream bs(outputFile, STREAM_WRITE);
+    if (!bs.is_open()) {
         cerr << "Error: cannot create output file '" << outputFile << "'\n";
         return 1;
     }
     
-    // Create BitStream for writing
-    BitStream bs(fsOut, STREAM_WRITE);
-    
     // Write header
-    // Format: samplerate(32), frames(64), blockSize(16), numCoeffs(16), quantBits(8)
+    // Format: samplerate(32), frames(64), blockSize(16), numCoeffs(16), quantBits(8, with the flags)
+    bs.enable_crc();
     bs.write_n_bits(samplerate, 32);
     bs.write_n_bits(frames, 64);
     bs.write_n_bits(blockSize, 16);
     bs.write_n_bits(numCoeffs, 16);
-    bs.write_n_bits(quantBits, 8);
+    bs.write_n_bits(quantBits | HEADER_FLAG_CRC | (channels == 2 ? HEADER_FLAG_STEREO : 0), 8);
     
     if (verbose) {
         cout << "Header written: " << (32 + 64 + 16 + 16 + 8) / 8 << " bytes\n";
@@ -151,9 +302,11 @@ int main(int argc, char *argv[]) {
                                          FFTW_REDFT10, FFTW_ESTIMATE);
     
     // Read and process audio in blocks
-    vector<short> samples(blockSize);
+    vector<short> samples(blockSize * channels);
+    vector<vector<double>> channelCoeffs(channels, vector<double>(blockSize));
     size_t totalBlocks = 0;
     size_t totalCoeffsWritten = 0;
+    size_t midSideBlocks = 0;
     
     while (true) {
         size_t nRead = sfhIn.readf(samples.data(), blockSize);
@@ -161,60 +314,46 @@ int main(int argc, char *argv[]) {
         
         // Zero-pad if last block is incomplete
         if (nRead < blockSize) {
-            for (size_t i = nRead; i < blockSize; i++) {
+            for (size_t i = nRead * channels; i < blockSize * channels; i++) {
                 samples[i] = 0;
             }
         }
         
-        // Convert to double and normalize
-        for (size_t i = 0; i < blockSize; i++) {
-            audioBlock[i] = samples[i] / 32768.0;
-        }
-        
-        // Perform DCT
-        fftw_execute(dctPlan);
-        
-        // Normalize DCT output
-        double norm = sqrt(2.0 / blockSize);
-        dctCoeffs[0] *= sqrt(1.0 / blockSize);
-        for (size_t i = 1; i < blockSize; i++) {
-            dctCoeffs[i] *= norm;
-        }
-        
-        // Find max absolute value for quantization scaling
-        double maxCoeff = 0.0;
-        for (size_t i = 0; i < numCoeffs; i++) {
-            double absVal = fabs(dctCoeffs[i]);
-            if (absVal > maxCoeff) maxCoeff = absVal;
+        for (int c = 0; c < channels; c++) {
+            // Convert to double and normalize
+            for (size_t i = 0; i < blockSize; i++) {
+                audioBlock[i] = samples[i * channels + c] / 32768.0;
+            }
+            
+            // Perform DCT
+            fftw_execute(dctPlan);
+            
+            // Normalize DCT output
+            double norm = sqrt(2.0 / blockSize);
+            dctCoeffs[0] *= sqrt(1.0 / blockSize);
+            for (size_t i = 1; i < blockSize; i++) {
+                dctCoeffs[i] *= norm;
+            }
+            
+            copy(dctCoeffs, dctCoeffs + blockSize, channelCoeffs[c].begin());
         }
         
-        // Avoid division by zero
-        if (maxCoeff < 1e-10) maxCoeff = 1.0;
-        
-        // Write scaling factor as float (32 bits)
-        uint32_t maxBits;
-        float maxCoeffFloat = (float)maxCoeff;  // Convert to float explicitly
-        memcpy(&maxBits, &maxCoeffFloat, sizeof(float));
-        bs.write_n_bits(maxBits, 32);
-        
-        // Quantize and write coefficients
-        int maxLevel = (1 << quantBits) - 1;
-        for (size_t i = 0; i < numCoeffs; i++) {
-            // Normalize to [-1, 1] and quantize
-            double normalized = dctCoeffs[i] / maxCoeff;
-            
-            // Map to [0, maxLevel]
-            int level = (int)round((normalized + 1.0) * maxLevel / 2.0);
+        if (channels == 2) {
+            midSideBlocks += writeStereoBlock(bs, channelCoeffs[0], channelCoeffs[1], numCoeffs, quantBits);
+        } else {
+            // Find max absolute value for quantization scaling
+            double maxCoeff = maxAbs(channelCoeffs[0], numCoeffs);
             
-            // Clamp
-            if (level < 0) level = 0;
-            if (level > maxLevel) level = maxLevel;
+            // Avoid division by zero
+            if (maxCoeff < 1e-10) maxCoeff = 1.0;
             
-            bs.write_n_bits(level, quantBits);
+            // Write scaling factor, then quantize and write coefficients
+            writeScale(bs, maxCoeff);
+            writeLevels(bs, channelCoeffs[0].data(), numCoeffs, maxCoeff, quantBits);
         }
         
         totalBlocks++;
-        totalCoeffsWritten += numCoeffs;
+        totalCoeffsWritten += numCoeffs * channels;
         
         if (verbose && totalBlocks % 100 == 0) {
             cout << "Processed " << totalBlocks << " blocks...\n";
@@ -226,18 +365,22 @@ int main(int argc, char *argv[]) {
     fftw_free(audioBlock);
     fftw_free(dctCoeffs);
     
-    bs.close();
+    bs.write_crc();
+    off_t fileSize = bs.tell();
+    if (!bs.close()) {
+        cerr << "Error: cannot write output file '" << outputFile << "'\n";
+        return 1;
+    }
     
     if (verbose) {
         cout << "\nEncoding complete!\n";
         cout << "Total blocks processed: " << totalBlocks << "\n";
         cout << "Total coefficients written: " << totalCoeffsWritten << "\n";
+        if (channels == 2) {
+            cout << "Mid/side blocks: " << midSideBlocks << "\n";
+        }
         
-        // Get actual file size
-        fsOut.seekg(0, ios::end);
-        streampos fileSize = fsOut.tellg();
-        
-        long long originalSize = frames * 2; // 16 bits = 2 bytes
+        long long originalSize = frames * channels * 2; // 16 bits = 2 bytes
         double actualCompressionRatio = (double)originalSize / fileSize;
         
         cout << "Original size: " << originalSize << " bytes\n";
@@ -245,7 +388,5 @@ int main(int argc, char *argv[]) {
         cout << "Actual compression ratio: " << actualCompressionRatio << ":1\n";
     }
     
-    fsOut.close();
-    
     return 0;
 }
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <vector>
+#include <fstream>
+#include <span>
+#include <sndfile.hh>
+#include "bit_stream.h"
+#include "lossless_codec.h"
+
+using namespace std;
+
+constexpr int HEADER_FLAG_CRC = 0x80; // In the flags field: the file ends with a CRC32C trailer
+
+int main(int argc, char *argv[]) {
+    bool verbose = false;
+
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " [-v (verbose)] input.bin output.wav\n";
+        cerr << "Decodes a losslessly encoded binary file to a WAV file.\n";
+        cerr << "\nOptions:\n";
+        cerr << "  -v           Enable verbose output\n";
+        cerr << "\nThe input file must be created by wav_lossless_enc.\n";
+        cerr << "The decoder rebuilds the original samples exactly, block by block, checking\n";
+        cerr << "the sync code and index of every block and the file checksum.\n";
+        cerr << "Use - as input.bin or output.wav to read from stdin or write to stdout.\n";
+        cerr << "\nExample:\n";
+        cerr << "  " << argv[0] << " compressed.bin output.wav\n";
+        cerr << "  " << argv[0] << " -v encoded.bin decoded.wav\n";
+        return 1;
+    }
+
+    string inputFile, outputFile;
+
+    // Parse command line arguments
+    for (int n = 1; n < argc; n++) {
+        if (string(argv[n]) == "-v") {
+            verbose = true;
+        } else if (inputFile.empty()) {
+            inputFile = argv[n];
+        } else if (outputFile.empty()) {
+            outputFile = argv[n];
+        }
+    }
+
+    if (inputFile.empty() || outputFile.empty()) {
+        cerr << "Error: both input and output files must be specified\n";
+        return 1;
+    }
+
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+
+    // Open input binary file for reading (memory-mapped when it is a regular file)
+    BitStream bs(inputFile, STREAM_READ);
+    if (!bs.is_open()) {
+        cerr << "Error: cannot open input file '" << inputFile << "'\n";
+        return 1;
+    }
+    bs.enable_crc();
+
+    // Read header information
+    // Format: channels (16 bits), samplerate (32 bits), frames (64 bits), block size (16 bits), flags (8 bits)
+    int channels = bs.read_n_bits(16);
+    int samplerate = bs.read_n_bits(32);
+    sf_count_t frames = bs.read_n_bits(64);
+    size_t blockSize = bs.read_n_bits(16);
+    int flags = bs.read_n_bits(8);
+    bool hasCrc = flags & HEADER_FLAG_CRC;
+
+    // Validate header
+    if (bs.overrun()) {
+        cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+        return 1;
+    }
+
+    if (channels < 1 || channels > 16) {
+        cerr << "Error: invalid number of channels (" << channels << ") in header\n";
+        return 1;
+    }
+
+    if (samplerate < 1000 || samplerate > 192000) {
+        cerr << "Error: invalid sample rate (" << samplerate << ") in header\n";
+        return 1;
+    }
+
+    if (blockSize < 16) {
+        cerr << "Error: invalid block size (" << blockSize << ") in header\n";
+        return 1;
+    }
+
+    if (verbose) {
+        cout << "=== WAV Lossless Decoder ===\n";
+        cout << "Input file: " << inputFile << "\n";
+        cout << "Output file: " << outputFile << "\n";
+        cout << "Channels: " << channels << "\n";
+        cout << "Sample rate: " << samplerate << " Hz\n";
+        cout << "Frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
+        cout << "Block size: " << blockSize << " frames\n";
+
+        long long outputSize = frames * channels * 2; // 16 bits = 2 bytes
+        cout << "Output size: " << outputSize << " bytes\n";
+
+        cout << "\nDecoding...\n";
+    }
+
+    // Open output WAV file
+    SndfileHandle sfhOut { outputFile, SFM_WRITE,
+                          SF_FORMAT_WAV | SF_FORMAT_PCM_16,
+                          channels, samplerate };
+
+    if (sfhOut.error()) {
+        cerr << "Error: cannot create output file '" << outputFile << "'\n";
+        cerr << sfhOut.strError() << "\n";
+        return 1;
+    }
+
+    // Process audio data, a block at a time
+    vector<short> samples(blockSize * channels);
+    sf_count_t totalFramesProcessed = 0;
+    uint64_t block = 0;
+
+    while (totalFramesProcessed < frames) {
+        size_t nFrames = min((sf_count_t)blockSize, frames - totalFramesProcessed);
+
+        bool decoded = lossless_decode_frame(bs, span(samples.data(), nFrames * channels), channels, block);
+        if (bs.overrun()) { // Past the end of the input, the bits read are zeros
+            cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+            return 1;
+        }
+        if (!decoded) {
+            cerr << "Error: lost synchronization at block " << block << ", the input file is corrupted\n";
+            return 1;
+        }
+
+        // Write decoded samples to WAV file
+        sfhOut.writef(samples.data(), nFrames);
+
+        totalFramesProcessed += nFrames;
+        block++;
+
+        if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
+            cout << "Processed " << totalFramesProcessed << " frames ("
+                 << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+        }
+    }
+
+    if (hasCrc && !bs.check_crc()) {
+        cerr << "Error: checksum mismatch, the input file is corrupted\n";
+        return 1;
+    }
+
+    // Close the bit stream
+    bs.close();
+
+    if (verbose) {
+        cout << "\nDecoding complete!\n";
+        cout << "Total frames decoded: " << totalFramesProcessed << " (" << block << " blocks)\n";
+        cout << "Checksum: " << (hasCrc ? "OK" : "not checked") << "\n";
+        cout << "Output WAV file created: " << outputFile << "\n";
+    }
+
+    return 0;
+}
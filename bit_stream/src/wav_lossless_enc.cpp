@@ -0,0 +1,280 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <span>
+#include <thread>
+#include <sndfile.hh>
+#include "bit_stream.h"
+#include "lossless_codec.h"
+#include "lpc_codec.h"
+
+using namespace std;
+
+constexpr size_t FRAMES_BUFFER_SIZE = 65536; // Buffer for reading frames (rounded down to whole blocks)
+constexpr int HEADER_FLAG_CRC = 0x80; // In the flags field: the file ends with a CRC32C trailer
+
+// Block settings shared by the encoding tasks
+struct BlockCoding {
+    int channels;
+    size_t blockSize; // Frames per block (the codec's frames)
+    int order; // Maximum LPC order
+    bool verify; // Decode every block and compare it with its samples
+};
+
+// A buffer of blocks encoded on its own, to be spliced into the output with
+// write_bits
+struct PackedBuffer {
+    vector<uint8_t> data;
+    uint64_t bits = 0;
+    bool verified = true; // Every block decoded to its samples (when verifying)
+};
+
+PackedBuffer encodeBlocks(vector<short> samples, const BlockCoding& coding, uint64_t firstBlock) {
+    PackedBuffer packed;
+    size_t nFrames = samples.size() / coding.channels;
+    {
+        BitStream bs(packed.data);
+        uint64_t index = firstBlock;
+        for (size_t f = 0; f < nFrames; f += coding.blockSize) {
+            size_t n = min(coding.blockSize, nFrames - f);
+            lossless_encode_frame(bs, span(samples).subspan(f * coding.channels, n * coding.channels),
+                                  coding.channels, index++, coding.order);
+        }
+        packed.bits = bs.tell_bit();
+        bs.close();
+    }
+    
+    if (coding.verify) {
+        BitStream bs(span<const uint8_t>(packed.data));
+        vector<short> decoded(coding.blockSize * coding.channels);
+        uint64_t index = firstBlock;
+        for (size_t f = 0; f < nFrames && packed.verified; f += coding.blockSize) {
+            size_t n = min(coding.blockSize, nFrames - f);
+            span<short> block(decoded.data(), n * coding.channels);
+            packed.verified = lossless_decode_frame(bs, block, coding.channels, index++) && !bs.overrun() &&
+                              equal(block.begin(), block.end(), samples.begin() + f * coding.channels);
+        }
+    }
+    
+    return packed;
+}
+
+int main(int argc, char *argv[]) {
+    bool verbose = false;
+    size_t blockSize = 4096; // Frames per block
+    int order = 12; // Maximum linear prediction order (0: fixed predictors only)
+    bool verify = false; // Decode the output and compare it with the input
+    int threads = max(1u, thread::hardware_concurrency()); // Encoding threads
+    
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " [-v (verbose)] [-b frames] [-p order] [-t threads] [-V]\n"
+             << "       input.wav output.bin\n";
+        cerr << "Encodes a WAV file losslessly, with linear prediction and Rice coding.\n";
+        cerr << "\nOptions:\n";
+        cerr << "  -v           Enable verbose output\n";
+        cerr << "  -b frames    Frames per block (16-" << LOSSLESS_MAX_FRAME_SIZE << ", default: 4096)\n";
+        cerr << "  -p order     Maximum order of the linear predictors (0-" << LPC_MAX_ORDER
+             << ", default: 12;\n";
+        cerr << "               0 uses the fixed polynomial predictors only)\n";
+        cerr << "  -t threads   Encoding threads (default: number of cores)\n";
+        cerr << "  -V           Verify: decode every block and compare it with the input\n";
+        cerr << "\nThe output is a binary file containing:\n";
+        cerr << "  - Header: channels, samplerate, frames, block size, flags\n";
+        cerr << "  - Independent blocks, each starting with a sync code and its index, with\n";
+        cerr << "    every channel coded verbatim or as a predictor and its Rice coded residual\n";
+        cerr << "  - CRC32C of the file, checked by the decoder\n";
+        cerr << "\nUse - as input.wav or output.bin to read from stdin or write to stdout.\n";
+        cerr << "\nExample:\n";
+        cerr << "  " << argv[0] << " input.wav output.bin\n";
+        cerr << "  " << argv[0] << " -v -p 32 -V audio.wav compressed.bin\n";
+        return 1;
+    }
+    
+    string inputFile, outputFile;
+    
+    // Parse command line arguments
+    for (int n = 1; n < argc; n++) {
+        if (string(argv[n]) == "-v") {
+            verbose = true;
+        } else if (string(argv[n]) == "-b") {
+            if (n + 1 < argc) {
+                long value = atol(argv[++n]);
+                if (value < 16 || value > (long)LOSSLESS_MAX_FRAME_SIZE) {
+                    cerr << "Error: block size must be between 16 and " << LOSSLESS_MAX_FRAME_SIZE << "\n";
+                    return 1;
+                }
+                blockSize = value;
+            } else {
+                cerr << "Error: -b option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-p") {
+            if (n + 1 < argc) {
+                order = atoi(argv[++n]);
+                if (order < 0 || order > LPC_MAX_ORDER) {
+                    cerr << "Error: prediction order must be between 0 and " << LPC_MAX_ORDER << "\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -p option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-t") {
+            if (n + 1 < argc) {
+                threads = atoi(argv[++n]);
+                if (threads < 1 || threads > 256) {
+                    cerr << "Error: threads must be between 1 and 256\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -t option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-V") {
+            verify = true;
+        } else if (inputFile.empty()) {
+            inputFile = argv[n];
+        } else if (outputFile.empty()) {
+            outputFile = argv[n];
+        }
+    }
+    
+    if (inputFile.empty() || outputFile.empty()) {
+        cerr << "Error: both input and output files must be specified\n";
+        return 1;
+    }
+    
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    
+    // Open input WAV file
+    SndfileHandle sfhIn { inputFile };
+    if (sfhIn.error()) {
+        cerr << "Error: cannot open input file '" << inputFile << "'\n";
+        cerr << sfhIn.strError() << "\n";
+        return 1;
+    }
+    
+    // Validate input format
+    if ((sfhIn.format() & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV) {
+        cerr << "Error: input file is not in WAV format\n";
+        return 1;
+    }
+    
+    if ((sfhIn.format() & SF_FORMAT_SUBMASK) != SF_FORMAT_PCM_16) {
+        cerr << "Error: input file is not in 16-bit PCM format\n";
+        return 1;
+    }
+    
+    int channels = sfhIn.channels();
+    int samplerate = sfhIn.samplerate();
+    sf_count_t frames = sfhIn.frames();
+    
+    if (verbose) {
+        cout << "=== WAV Lossless Encoder ===\n";
+        cout << "Input file: " << inputFile << "\n";
+        cout << "Output file: " << outputFile << "\n";
+        cout << "Channels: " << channels << "\n";
+        cout << "Sample rate: " << samplerate << " Hz\n";
+        cout << "Frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
+        cout << "Block size: " << blockSize << " frames\n";
+        cout << "Linear prediction: " << (order > 0 ? "up to order " + to_string(order) : "fixed predictors only")
+             << "\n";
+        cout << "Encoding threads: " << threads << "\n";
+        cout << "Verification: " << (verify ? "on" : "off") << "\n";
+        cout << "Original size: " << frames * channels * 2 << " bytes\n";
+        cout << "\nEncoding...\n";
+    }
+    
+    // Open output binary file (or stdout)
+    BitStream bs(outputFile, STREAM_WRITE);
+    if (!bs.is_open()) {
+        cerr << "Error: cannot create output file '" << outputFile << "'\n";
+        return 1;
+    }
+    bs.enable_crc();
+    
+    // Write header information (whole bytes, so that the blocks start on byte boundaries)
+    // Format: channels (16 bits), samplerate (32 bits), frames (64 bits), block size (16 bits), flags (8 bits)
+    bs.write_n_bits(channels, 16);
+    bs.write_n_bits(samplerate, 32);
+    bs.write_n_bits(frames, 64);
+    bs.write_n_bits(blockSize, 16);
+    bs.write_n_bits(HEADER_FLAG_CRC, 8);
+    
+    // Every buffer read is encoded by a task of its own, into memory; the
+    // encoded buffers are spliced into the output in order, with up to two
+    // per thread in flight (with one thread, each is encoded right away)
+    const BlockCoding coding { channels, blockSize, order, verify };
+    size_t bufferFrames = blockSize * max<size_t>(1, FRAMES_BUFFER_SIZE / blockSize);
+    deque<future<PackedBuffer>> pending;
+    sf_count_t totalFramesProcessed = 0;
+    uint64_t nextBlock = 0;
+    bool eof = false;
+    
+    while (!eof || !pending.empty()) {
+        while (!eof && pending.size() < 2 * (size_t)threads) {
+            vector<short> samples(bufferFrames * channels);
+            size_t nFrames = sfhIn.readf(samples.data(), bufferFrames);
+            if (nFrames == 0) {
+                eof = true;
+                break;
+            }
+            
+            samples.resize(nFrames * channels);
+            launch policy = threads > 1 ? launch::async : launch::deferred;
+            pending.push_back(async(policy, encodeBlocks, move(samples), cref(coding), nextBlock));
+            nextBlock += (nFrames + blockSize - 1) / blockSize;
+            
+            totalFramesProcessed += nFrames;
+            
+            if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
+                cout << "Processed " << totalFramesProcessed << " frames ("
+                     << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+            }
+            
+            if (threads == 1) {
+                break;
+            }
+        }
+        
+        if (!pending.empty()) {
+            PackedBuffer packed = pending.front().get();
+            pending.pop_front();
+            if (!packed.verified) {
+                cerr << "Error: verification failed, the decoded samples differ from the input\n";
+                return 1;
+            }
+            bs.write_bits(packed.data, packed.bits);
+        }
+    }
+    
+    // Append the checksum and close the bit stream (flushes any remaining bits)
+    bs.write_crc();
+    off_t fileSize = bs.tell();
+    if (!bs.close()) {
+        cerr << "Error: cannot write output file '" << outputFile << "'\n";
+        return 1;
+    }
+    
+    if (verbose) {
+        cout << "\nEncoding complete!\n";
+        cout << "Total frames encoded: " << totalFramesProcessed << " (" << nextBlock << " blocks)\n";
+        if (verify) {
+            cout << "Verification: every block decodes to the input\n";
+        }
+        cout << "Output file size: " << fileSize << " bytes\n";
+        
+        long long originalSize = frames * channels * 2; // 16 bits = 2 bytes
+        double actualCompressionRatio = (double)originalSize / fileSize;
+        cout << "Actual compression ratio (including header): "
+             << actualCompressionRatio << ":1\n";
+    }
+    
+    return 0;
+}
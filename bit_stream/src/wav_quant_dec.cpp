@@ -1,12 +1,31 @@
 #include <iostream>
 #include <vector>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <sys/stat.h>
 #include <sndfile.hh>
 #include "bit_stream.h"
+#include "packed_codec.h"
+#include "rice_codec.h"
+#include "lpc_codec.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536; // Buffer for writing frames
+constexpr uint64_t HEADER_BITS = 16 + 32 + 64 + 8; // channels, samplerate, frames, bits
+constexpr int HEADER_FLAG_CRC = 0x80; // In the bits field: the file ends with a CRC32C trailer
+constexpr int HEADER_FLAG_RICE = 0x40; // In the bits field: the levels are Rice coded (see rice_codec.h)
+constexpr int HEADER_FLAG_LPC = 0x20; // In the bits field: the prediction residuals are coded (see lpc_codec.h)
+
+// Rice and LPC coded blocks are decoded a buffer at a time, so the buffers must hold whole blocks
+static_assert(FRAMES_BUFFER_SIZE % RICE_BLOCK_FRAMES == 0);
+static_assert(FRAMES_BUFFER_SIZE % LPC_BLOCK_FRAMES == 0);
 
 // Reconstruct sample from quantization level
 short levelToSample(int level, int bits) {
@@ -33,16 +52,132 @@ short levelToSample(int level, int bits) {
     return reconstructed;
 }
 
+// Sample reconstructed from every level for the given bits: dequantizing then
+// takes a single load per sample
+vector<short> sampleTable(int bits) {
+    vector<short> table(1 << bits);
+    for (int level = 0; level < (1 << bits); level++) {
+        table[level] = levelToSample(level, bits);
+    }
+    
+    return table;
+}
+
+// Decode nFrames frames starting at frame 'first', seeking bs straight to
+// them. Returns the samples, or nothing if the input ends before them.
+vector<short> decodeFrames(BitStream& bs, const PackedCodecOps& codec, const vector<short>& toSample,
+                           int channels, int bits, sf_count_t first, size_t nFrames) {
+    if (!bs.seek_bit(HEADER_BITS + (uint64_t)first * channels * bits)) {
+        return {};
+    }
+    
+    vector<uint16_t> levels(nFrames * channels);
+    codec.unpack(bs, span(levels));
+    if (bs.overrun()) {
+        return {};
+    }
+    
+    vector<short> samples(nFrames * channels);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = toSample[levels[i]];
+    }
+    
+    return samples;
+}
+
+// Decodes frames [first, end) of a fixed-width input file on a pool of
+// threads, each reading the file through a bit stream of its own: thread t
+// takes buffers t, t + threads, t + 2 * threads, ... and keeps at most two
+// decoded ones waiting, so next() gets every buffer in order with bounded
+// memory. A failed buffer ends its thread.
+class ParallelDecoder {
+public:
+    ParallelDecoder(const string& inputFile, const PackedCodecOps& codec, const vector<short>& toSample,
+                    int channels, int bits, sf_count_t first, sf_count_t end, int threads) {
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(make_unique<Worker>());
+        }
+        
+        sf_count_t stride = (sf_count_t)FRAMES_BUFFER_SIZE * threads;
+        for (int t = 0; t < threads; t++) {
+            Worker& w = *workers[t];
+            w.task = thread([&inputFile, &codec, &toSample, &w, channels, bits, first, end, stride, t] {
+                BitStream bs(inputFile, STREAM_READ);
+                for (sf_count_t f = first + (sf_count_t)t * FRAMES_BUFFER_SIZE; f < end; f += stride) {
+                    size_t nFrames = min((sf_count_t)FRAMES_BUFFER_SIZE, end - f);
+                    vector<short> samples;
+                    if (bs.is_open()) {
+                        samples = decodeFrames(bs, codec, toSample, channels, bits, f, nFrames);
+                    }
+                    
+                    unique_lock<mutex> lock(w.lock);
+                    w.changed.wait(lock, [&w] { return w.decoded.size() < 2 || w.stop; });
+                    if (w.stop) {
+                        return;
+                    }
+                    bool failed = samples.empty();
+                    w.decoded.push_back(move(samples));
+                    w.changed.notify_all();
+                    if (failed) {
+                        return;
+                    }
+                }
+            });
+        }
+    }
+    
+    ~ParallelDecoder() {
+        for (auto& w : workers) {
+            {
+                lock_guard<mutex> lock(w->lock);
+                w->stop = true;
+            }
+            w->changed.notify_all();
+            w->task.join();
+        }
+    }
+    
+    // The samples of the next buffer, or nothing if the input ends before it
+    vector<short> next() {
+        Worker& w = *workers[nextBuffer++ % workers.size()];
+        unique_lock<mutex> lock(w.lock);
+        w.changed.wait(lock, [&w] { return !w.decoded.empty(); });
+        vector<short> samples = move(w.decoded.front());
+        w.decoded.pop_front();
+        w.changed.notify_all();
+        return samples;
+    }
+    
+private:
+    struct Worker {
+        mutex lock;
+        condition_variable changed;
+        deque<vector<short>> decoded;
+        bool stop = false;
+        thread task;
+    };
+    
+    vector<unique_ptr<Worker>> workers;
+    size_t nextBuffer = 0;
+};
+
 int main(int argc, char *argv[]) {
     bool verbose = false;
+    double startTime = 0.0; // Seconds to skip at the beginning
+    int threads = max(1u, thread::hardware_concurrency()); // Decoding threads
     
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " [-v (verbose)] input.bin output.wav\n";
+        cerr << "Usage: " << argv[0] << " [-v (verbose)] [-s start] [-t threads] input.bin output.wav\n";
         cerr << "Decodes a packed binary file to a WAV file.\n";
         cerr << "\nOptions:\n";
         cerr << "  -v           Enable verbose output\n";
+        cerr << "  -s start     Start decoding at this time, in seconds (default: 0)\n";
+        cerr << "  -t threads   Decoding threads (default: number of cores; 1 unless\n";
+        cerr << "               the input is a regular file)\n";
         cerr << "\nThe input file must be created by wav_quant_enc.\n";
         cerr << "The decoder reads the header and reconstructs the quantized WAV file.\n";
+        cerr << "The file checksum, if present, is verified when decoding from the start.\n";
+        cerr << "Use - as input.bin or output.wav to read from stdin or write to stdout.\n";
         cerr << "\nExample:\n";
         cerr << "  " << argv[0] << " compressed.bin output.wav\n";
         cerr << "  " << argv[0] << " -v encoded.bin decoded.wav\n";
@@ -55,6 +190,28 @@ int main(int argc, char *argv[]) {
     for (int n = 1; n < argc; n++) {
         if (string(argv[n]) == "-v") {
             verbose = true;
+        } else if (string(argv[n]) == "-s") {
+            if (n + 1 < argc) {
+                startTime = atof(argv[++n]);
+                if (startTime < 0.0) {
+                    cerr << "Error: start time must not be negative\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -s option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-t") {
+            if (n + 1 < argc) {
+                threads = atoi(argv[++n]);
+                if (threads < 1 || threads > 256) {
+                    cerr << "Error: threads must be between 1 and 256\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -t option requires a value\n";
+                return 1;
+            }
         } else if (inputFile.empty()) {
             inputFile = argv[n];
         } else if (outputFile.empty()) {
@@ -67,15 +224,18 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    // Open input binary file
-    fstream fsIn(inputFile, ios::in | ios::binary);
-    if (!fsIn.is_open()) {
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    
+    // Open input binary file for reading (memory-mapped when it is a regular file)
+    BitStream bs(inputFile, STREAM_READ);
+    if (!bs.is_open()) {
         cerr << "Error: cannot open input file '" << inputFile << "'\n";
         return 1;
     }
-    
-    // Create BitStream for reading
-    BitStream bs(fsIn, STREAM_READ);
+    bs.enable_crc();
     
     // Read header information
     // Format: channels (16 bits), samplerate (32 bits), frames (64 bits), bits (8 bits)
@@ -83,8 +243,18 @@ int main(int argc, char *argv[]) {
     int samplerate = bs.read_n_bits(32);
     sf_count_t frames = bs.read_n_bits(64);
     int bits = bs.read_n_bits(8);
+    bool hasCrc = bits & HEADER_FLAG_CRC;
+    bool rice = bits & HEADER_FLAG_RICE;
+    bool lpc = bits & HEADER_FLAG_LPC;
+    bool fixedWidth = !rice && !lpc;
+    bits &= ~(HEADER_FLAG_CRC | HEADER_FLAG_RICE | HEADER_FLAG_LPC);
     
     // Validate header
+    if (bs.overrun()) {
+        cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+        return 1;
+    }
+    
     if (channels < 1 || channels > 16) {
         cerr << "Error: invalid number of channels (" << channels << ") in header\n";
         return 1;
@@ -100,6 +270,27 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // Every sample takes exactly 'bits' bits after the header, so decoding can
+    // start at any frame by seeking straight to its bit offset. Rice and LPC
+    // coded samples have no fixed offsets: they are decoded from the start,
+    // and the frames before startFrame are dropped.
+    sf_count_t startFrame = min((sf_count_t)(startTime * samplerate), frames);
+    if (startFrame > 0) {
+        if (fixedWidth && !bs.seek_bit(HEADER_BITS + (uint64_t)startFrame * channels * bits)) {
+            cerr << "Error: cannot seek to frame " << startFrame << "\n";
+            return 1;
+        }
+        frames -= startFrame;
+    }
+    
+    // Decoding in parallel needs the fixed offsets, and an input that every
+    // thread can open and read at any offset: a regular file (not stdin, a
+    // pipe or a process substitution)
+    struct stat st;
+    if (!fixedWidth || inputFile == "-" || stat(inputFile.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        threads = 1;
+    }
+    
     if (verbose) {
         cout << "=== WAV Quantization Decoder ===\n";
         cout << "Input file: " << inputFile << "\n";
@@ -109,6 +300,11 @@ int main(int argc, char *argv[]) {
         cout << "Frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
         cout << "Quantization bits: " << bits << "\n";
         cout << "Quantization levels: " << (1 << bits) << "\n";
+        cout << "Coding: " << (lpc ? "linear prediction" : rice ? "Rice" : "fixed") << "\n";
+        cout << "Decoding threads: " << threads << "\n";
+        if (startFrame > 0) {
+            cout << "Start frame: " << startFrame << " (" << (double)startFrame / samplerate << " seconds)\n";
+        }
         
         long long outputSize = frames * channels * 2; // 16 bits = 2 bytes
         cout << "Output size: " << outputSize << " bytes\n";
@@ -127,39 +323,113 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // Select the unpacking kernel specialized for this bit width
+    const PackedCodecOps& codec = packed_codec(bits);
+    const vector<short> toSample = sampleTable(bits);
+    
+    // The checksum covers the whole file, so it is only verified when it is
+    // read from the start
+    bool crcChecked = hasCrc && (startFrame == 0 || !fixedWidth);
+    
     // Process audio data
-    vector<short> samples(FRAMES_BUFFER_SIZE * channels);
     sf_count_t totalFramesProcessed = 0;
     sf_count_t framesToRead = frames;
     
-    while (framesToRead > 0) {
-        size_t nFrames = min((sf_count_t)FRAMES_BUFFER_SIZE, framesToRead);
+    if (threads > 1) {
+        // The buffers of frames are decoded by a pool of threads (see
+        // ParallelDecoder) and written in order. Meanwhile, the main bit
+        // stream skips over the samples to the trailer, checksumming them.
+        future<bool> crcCheck;
+        if (crcChecked) {
+            uint64_t sampleBits = (uint64_t)frames * channels * bits;
+            crcCheck = async(launch::async, [&bs, sampleBits] {
+                bs.skip_bits(sampleBits);
+                return bs.check_crc();
+            });
+        }
         
-        // Read and decode each sample
-        for (size_t i = 0; i < nFrames * channels; i++) {
-            int level = bs.read_n_bits(bits);
-            samples[i] = levelToSample(level, bits);
+        ParallelDecoder decoder(inputFile, codec, toSample, channels, bits, startFrame, startFrame + frames,
+                                threads);
+        while (framesToRead > 0) {
+            vector<short> samples = decoder.next();
+            if (samples.empty()) {
+                cerr << "Error: input file is truncated\n";
+                return 1;
+            }
+            
+            // Write decoded samples to WAV file
+            size_t nFrames = samples.size() / channels;
+            sfhOut.writef(samples.data(), nFrames);
+            
+            totalFramesProcessed += nFrames;
+            framesToRead -= nFrames;
+            
+            if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
+                cout << "Processed " << totalFramesProcessed << " frames ("
+                     << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+            }
         }
         
-        // Write decoded samples to WAV file
-        sfhOut.writef(samples.data(), nFrames);
+        if (crcChecked && !crcCheck.get()) {
+            cerr << "Error: checksum mismatch, the input file is corrupted\n";
+            return 1;
+        }
+    } else {
+        vector<short> samples(FRAMES_BUFFER_SIZE * channels);
+        vector<uint16_t> levels(FRAMES_BUFFER_SIZE * channels);
+        sf_count_t framesToDrop = fixedWidth ? 0 : startFrame;
+        framesToRead += framesToDrop;
         
-        totalFramesProcessed += nFrames;
-        framesToRead -= nFrames;
+        while (framesToRead > 0) {
+            size_t nFrames = min((sf_count_t)FRAMES_BUFFER_SIZE, framesToRead);
+            
+            // Decode the whole buffer at once: the samples straight from their
+            // prediction residuals, or the levels, then each sample
+            if (lpc) {
+                lpc_decode(bs, span(samples.data(), nFrames * channels), channels, bits);
+            } else {
+                span<uint16_t> buffer(levels.data(), nFrames * channels);
+                if (rice) {
+                    rice_unpack(bs, buffer, channels, bits);
+                } else {
+                    codec.unpack(bs, buffer);
+                }
+                for (size_t i = 0; i < nFrames * channels; i++) {
+                    samples[i] = toSample[levels[i]];
+                }
+            }
+            if (bs.overrun()) { // Past the end of the input, the bits read are zeros
+                cerr << "Error: " << (bs.error() ? "cannot read input file" : "input file is truncated") << "\n";
+                return 1;
+            }
+            
+            // Write decoded samples to WAV file
+            size_t dropped = min((sf_count_t)nFrames, framesToDrop);
+            sfhOut.writef(samples.data() + dropped * channels, nFrames - dropped);
+            framesToDrop -= dropped;
+            
+            totalFramesProcessed += nFrames - dropped;
+            framesToRead -= nFrames;
+            
+            if (verbose && dropped < nFrames && totalFramesProcessed % (samplerate * 5) == 0) {
+                cout << "Processed " << totalFramesProcessed << " frames ("
+                     << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+            }
+        }
         
-        if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
-            cout << "Processed " << totalFramesProcessed << " frames ("
-                 << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+        if (crcChecked && !bs.check_crc()) {
+            cerr << "Error: checksum mismatch, the input file is corrupted\n";
+            return 1;
         }
     }
     
     // Close the bit stream
     bs.close();
-    fsIn.close();
     
     if (verbose) {
         cout << "\nDecoding complete!\n";
         cout << "Total frames decoded: " << totalFramesProcessed << "\n";
+        cout << "Checksum: " << (crcChecked ? "OK" : "not checked") << "\n";
         cout << "Output WAV file created: " << outputFile << "\n";
     }
     
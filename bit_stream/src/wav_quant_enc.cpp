@@ -1,13 +1,31 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <span>
+#include <thread>
 #include <sndfile.hh>
 #include "bit_stream.h"
+#include "packed_codec.h"
+#include "rice_codec.h"
+#include "lpc_codec.h"
 
 using namespace std;
 
 constexpr size_t FRAMES_BUFFER_SIZE = 65536; // Buffer for reading frames
+constexpr int HEADER_FLAG_CRC = 0x80; // In the bits field: the file ends with a CRC32C trailer
+constexpr int HEADER_FLAG_RICE = 0x40; // In the bits field: the levels are Rice coded (see rice_codec.h)
+constexpr int HEADER_FLAG_LPC = 0x20; // In the bits field: the prediction residuals are coded (see lpc_codec.h)
+
+// Rice and LPC coded buffers are encoded separately, so they must hold whole blocks
+static_assert(FRAMES_BUFFER_SIZE % RICE_BLOCK_FRAMES == 0);
+static_assert(FRAMES_BUFFER_SIZE % LPC_BLOCK_FRAMES == 0);
+
+using PackFunction = function<void(BitStream&, span<const uint16_t>)>;
+using EncodeFunction = function<void(BitStream&, span<const short>)>;
 
 // Perform uniform scalar quantization and return quantized level (0 to 2^bits-1)
 int quantizeToLevel(short sample, int bits) {
@@ -38,19 +56,74 @@ int quantizeToLevel(short sample, int bits) {
     return level;
 }
 
+// Level of every 16-bit sample for the given bits, indexed by the sample's
+// bit pattern: quantizing then takes a single load per sample
+vector<uint16_t> levelTable(int bits) {
+    vector<uint16_t> table(65536);
+    for (int sample = -32768; sample <= 32767; sample++) {
+        table[(uint16_t)sample] = quantizeToLevel(sample, bits);
+    }
+    
+    return table;
+}
+
+// A buffer of samples encoded on its own, to be spliced into the output with
+// write_bits
+struct PackedBuffer {
+    vector<uint8_t> data;
+    uint64_t bits = 0;
+};
+
+PackedBuffer encodeFrames(vector<short> samples, const EncodeFunction& encode) {
+    PackedBuffer packed;
+    {
+        BitStream bs(packed.data);
+        encode(bs, span(samples));
+        packed.bits = bs.tell_bit();
+        bs.close();
+    }
+    
+    return packed;
+}
+
 int main(int argc, char *argv[]) {
     bool verbose = false;
     int bits = 8; // Default quantization bits
+    bool rice = false; // Rice code the levels instead of storing them in 'bits' bits
+    int order = 0; // Maximum linear prediction order (0: quantize the samples themselves)
+    int writeBuffers = 4; // Output buffers (written in the background when > 1)
+    size_t bufferKiB = BYTE_STREAM_BUF_SIZE / 1024; // Size of each output buffer
+    bool direct = false; // Write with O_DIRECT
+    int threads = max(1u, thread::hardware_concurrency()); // Encoding threads
     
     if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " [-v (verbose)] [-b bits] input.wav output.bin\n";
+        cerr << "Usage: " << argv[0] << " [-v (verbose)] [-b bits] [-e fixed|rice] [-p order] [-t threads]\n"
+             << "       [-w buffers] [-k KiB] [-d] input.wav output.bin\n";
         cerr << "Encodes a WAV file using uniform scalar quantization and bit packing.\n";
         cerr << "\nOptions:\n";
         cerr << "  -v           Enable verbose output\n";
         cerr << "  -b bits      Number of bits per sample (1-16, default: 8)\n";
+        cerr << "  -e fixed     Store every level in 'bits' bits (default)\n";
+        cerr << "  -e rice      Rice code the levels, predicted by the mid level or the\n";
+        cerr << "               previous one, per block (smaller files)\n";
+        cerr << "  -p order     Quantize the residual of a linear predictor of up to this\n";
+        cerr << "               order (1-32), chosen per block, with the step of a 'bits'-bit\n";
+        cerr << "               quantizer; the residuals are Rice coded (-e does not apply)\n";
+        cerr << "  -t threads   Encoding threads (default: number of cores)\n";
+        cerr << "  -w buffers   Output buffers; with more than 1, they are written in the\n";
+        cerr << "               background (io_uring, or a helper thread) while encoding\n";
+        cerr << "               goes on (default: 4)\n";
+        cerr << "  -k KiB       Size of each output buffer, in KiB (4-65536, default: 64)\n";
+        cerr << "  -d           Write with O_DIRECT, bypassing the page cache (large archives)\n";
+        cerr << "\nWith -e rice or -p, every block of a stereo file is coded as left/right or as\n";
+        cerr << "mid/side, whichever takes fewer bits. With -e rice, mid/side is reversible and\n";
+        cerr << "the levels decoded are the same; with -p, left and right keep the same mean\n";
+        cerr << "squared error (SNR), though their peak error may be larger.\n";
         cerr << "\nThe output is a packed binary file containing:\n";
         cerr << "  - Header: channels, samplerate, frames, bits\n";
-        cerr << "  - Packed quantized samples using exactly 'bits' per sample\n";
+        cerr << "  - Packed quantized samples using exactly 'bits' per sample, or Rice coded\n";
+        cerr << "  - CRC32C of the file, checked by the decoder\n";
+        cerr << "\nUse - as input.wav or output.bin to read from stdin or write to stdout.\n";
         cerr << "\nExample:\n";
         cerr << "  " << argv[0] << " -b 8 input.wav output.bin\n";
         cerr << "  " << argv[0] << " -v -b 4 audio.wav compressed.bin\n";
@@ -74,6 +147,64 @@ int main(int argc, char *argv[]) {
                 cerr << "Error: -b option requires a value\n";
                 return 1;
             }
+        } else if (string(argv[n]) == "-e") {
+            if (n + 1 < argc) {
+                string mode = argv[++n];
+                if (mode != "fixed" && mode != "rice") {
+                    cerr << "Error: entropy coding must be fixed or rice\n";
+                    return 1;
+                }
+                rice = mode == "rice";
+            } else {
+                cerr << "Error: -e option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-p") {
+            if (n + 1 < argc) {
+                order = atoi(argv[++n]);
+                if (order < 1 || order > LPC_MAX_ORDER) {
+                    cerr << "Error: prediction order must be between 1 and " << LPC_MAX_ORDER << "\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -p option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-t") {
+            if (n + 1 < argc) {
+                threads = atoi(argv[++n]);
+                if (threads < 1 || threads > 256) {
+                    cerr << "Error: threads must be between 1 and 256\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -t option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-w") {
+            if (n + 1 < argc) {
+                writeBuffers = atoi(argv[++n]);
+                if (writeBuffers < 1 || writeBuffers > 64) {
+                    cerr << "Error: buffers must be between 1 and 64\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -w option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-k") {
+            if (n + 1 < argc) {
+                bufferKiB = atoi(argv[++n]);
+                if (bufferKiB < BYTE_STREAM_MIN_BUF_SIZE / 1024 || bufferKiB > BYTE_STREAM_MAX_BUF_SIZE / 1024) {
+                    cerr << "Error: buffer size must be between 4 and 65536 KiB\n";
+                    return 1;
+                }
+            } else {
+                cerr << "Error: -k option requires a value\n";
+                return 1;
+            }
+        } else if (string(argv[n]) == "-d") {
+            direct = true;
         } else if (inputFile.empty()) {
             inputFile = argv[n];
         } else if (outputFile.empty()) {
@@ -86,6 +217,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // With the output going to stdout, the messages go to stderr
+    if (outputFile == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    
     // Open input WAV file
     SndfileHandle sfhIn { inputFile };
     if (sfhIn.error()) {
@@ -118,69 +254,138 @@ int main(int argc, char *argv[]) {
         cout << "Frames: " << frames << " (" << (double)frames / samplerate << " seconds)\n";
         cout << "Quantization bits: " << bits << "\n";
         cout << "Quantization levels: " << (1 << bits) << "\n";
+        if (order > 0) {
+            cout << "Linear prediction: up to order " << order << ", Rice coded residuals\n";
+        } else {
+            cout << "Entropy coding: " << (rice ? "Rice" : "fixed") << "\n";
+        }
+        if (channels == 2 && (rice || order > 0)) {
+            cout << "Joint stereo: left/right or mid/side, chosen per block\n";
+        }
+        cout << "Encoding threads: " << threads << "\n";
         
-        // Calculate compression ratio
+        // Calculate compression ratio (variable-length sizes are only known at the end)
         long long originalBits = frames * channels * 16;
-        long long compressedBits = frames * channels * bits;
-        double compressionRatio = (double)originalBits / compressedBits;
-        
         cout << "Original size: " << originalBits / 8 << " bytes (" << originalBits << " bits)\n";
-        cout << "Compressed size (data only): " << compressedBits / 8 << " bytes (" << compressedBits << " bits)\n";
-        cout << "Compression ratio: " << compressionRatio << ":1\n";
+        if (!rice && order == 0) {
+            long long compressedBits = frames * channels * bits;
+            double compressionRatio = (double)originalBits / compressedBits;
+            
+            cout << "Compressed size (data only): " << compressedBits / 8 << " bytes (" << compressedBits << " bits)\n";
+            cout << "Compression ratio: " << compressionRatio << ":1\n";
+        }
         cout << "\nEncoding...\n";
     }
     
-    // Open output binary file
-    fstream fsOut(outputFile, ios::out | ios::binary);
-    if (!fsOut.is_open()) {
+    // Open output binary file (or stdout)
+    BitStream bs(outputFile, STREAM_WRITE, writeBuffers, bufferKiB * 1024, direct);
+    if (!bs.is_open()) {
         cerr << "Error: cannot create output file '" << outputFile << "'\n";
         return 1;
     }
-    
-    // Create BitStream for writing
-    BitStream bs(fsOut, STREAM_WRITE);
+    bs.enable_crc();
     
     // Write header information
     // Format: channels (16 bits), samplerate (32 bits), frames (64 bits), bits (8 bits)
     bs.write_n_bits(channels, 16);
     bs.write_n_bits(samplerate, 32);
     bs.write_n_bits(frames, 64);
-    bs.write_n_bits(bits, 8);
+    int flags = HEADER_FLAG_CRC | (order > 0 ? HEADER_FLAG_LPC : rice ? HEADER_FLAG_RICE : 0);
+    bs.write_n_bits(bits | flags, 8);
     
     if (verbose) {
         cout << "Header written: " << (16 + 32 + 64 + 8) / 8 << " bytes\n";
     }
     
+    // Select how the samples are coded: quantized, then packed by the kernel
+    // specialized for this bit width or Rice coded, or predicted
+    PackFunction pack = packed_codec(bits).pack;
+    if (rice) {
+        pack = [channels, bits](BitStream& bs, span<const uint16_t> levels) {
+            rice_pack(bs, levels, channels, bits);
+        };
+    }
+    const vector<uint16_t> toLevel = levelTable(bits);
+    
+    EncodeFunction encode = [&pack, &toLevel](BitStream& bs, span<const short> samples) {
+        vector<uint16_t> levels(samples.size());
+        for (size_t i = 0; i < samples.size(); i++) {
+            levels[i] = toLevel[(uint16_t)samples[i]];
+        }
+        pack(bs, span(levels));
+    };
+    if (order > 0) {
+        encode = [channels, bits, order](BitStream& bs, span<const short> samples) {
+            lpc_encode(bs, samples, channels, bits, order);
+        };
+    }
+    
     // Process audio data
     size_t nFrames;
     vector<short> samples(FRAMES_BUFFER_SIZE * channels);
     sf_count_t totalFramesProcessed = 0;
     
-    while ((nFrames = sfhIn.readf(samples.data(), FRAMES_BUFFER_SIZE)) > 0) {
-        // Quantize and write each sample
-        for (size_t i = 0; i < nFrames * channels; i++) {
-            int level = quantizeToLevel(samples[i], bits);
-            bs.write_n_bits(level, bits);
+    if (threads > 1) {
+        // Every buffer read is encoded by a task of its own, into memory; the
+        // encoded buffers are spliced into the output in order (so it is the
+        // same as encoding them one after the other), with up to two per
+        // thread in flight
+        deque<future<PackedBuffer>> pending;
+        bool eof = false;
+        while (!eof || !pending.empty()) {
+            while (!eof && pending.size() < 2 * (size_t)threads) {
+                nFrames = sfhIn.readf(samples.data(), FRAMES_BUFFER_SIZE);
+                if (nFrames == 0) {
+                    eof = true;
+                    break;
+                }
+                
+                samples.resize(nFrames * channels);
+                pending.push_back(async(launch::async, encodeFrames, move(samples), cref(encode)));
+                samples = vector<short>(FRAMES_BUFFER_SIZE * channels);
+                
+                totalFramesProcessed += nFrames;
+                
+                if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
+                    cout << "Processed " << totalFramesProcessed << " frames ("
+                         << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+                }
+            }
+            
+            if (!pending.empty()) {
+                PackedBuffer packed = pending.front().get();
+                pending.pop_front();
+                bs.write_bits(packed.data, packed.bits);
+            }
         }
-        
-        totalFramesProcessed += nFrames;
-        
-        if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
-            cout << "Processed " << totalFramesProcessed << " frames ("
-                 << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+    } else {
+        while ((nFrames = sfhIn.readf(samples.data(), FRAMES_BUFFER_SIZE)) > 0) {
+            // Encode the whole buffer at once
+            encode(bs, span(samples.data(), nFrames * channels));
+            
+            totalFramesProcessed += nFrames;
+            
+            if (verbose && totalFramesProcessed % (samplerate * 5) == 0) {
+                cout << "Processed " << totalFramesProcessed << " frames ("
+                     << (double)totalFramesProcessed / samplerate << " seconds)...\n";
+            }
         }
     }
     
-    // Close the bit stream (flushes any remaining bits)
-    bs.close();
+    // Append the checksum and close the bit stream (flushes any remaining bits)
+    bs.write_crc();
+    off_t fileSize = bs.tell();
+    if (!bs.close()) {
+        cerr << "Error: cannot write output file '" << outputFile << "'\n";
+        return 1;
+    }
     
     if (verbose) {
         cout << "\nEncoding complete!\n";
         cout << "Total frames encoded: " << totalFramesProcessed << "\n";
-        
-        // Get actual file size
-        fsOut.seekg(0, ios::end);
-        streampos fileSize = fsOut.tellg();
+        if (writeBuffers > 1) {
+            cout << "Waits for a free output buffer: " << bs.buffer_waits() << "\n";
+        }
         
         cout << "Output file size: " << fileSize << " bytes\n";
         
@@ -190,7 +395,5 @@ int main(int argc, char *argv[]) {
              << actualCompressionRatio << ":1\n";
     }
     
-    fsOut.close();
-    
     return 0;
 }
@@ -38,6 +38,17 @@ short quantizeUniform(short sample, int bits) {
     return quantized;
 }
 
+// Quantized value of every 16-bit sample for the given bits, indexed by the
+// sample's bit pattern: quantizing then takes a single load per sample
+vector<short> quantizationTable(int bits) {
+    vector<short> table(65536);
+    for (int sample = -32768; sample <= 32767; sample++) {
+        table[(uint16_t)sample] = quantizeUniform(sample, bits);
+    }
+    
+    return table;
+}
+
 int main(int argc, char *argv[]) {
     bool verbose = false;
     int targetBits = 8;
@@ -119,6 +130,7 @@ int main(int argc, char *argv[]) {
     }
     
     // Process audio data
+    const vector<short> toQuantized = quantizationTable(targetBits);
     size_t nFrames;
     vector<short> samples(FRAMES_BUFFER_SIZE * sfhIn.channels());
     size_t totalFrames = 0;
@@ -136,7 +148,7 @@ int main(int argc, char *argv[]) {
             short original = samples[i];
             short quantized;
             
-            quantized = quantizeUniform(original, targetBits);
+            quantized = toQuantized[(uint16_t)original];
 
             samples[i] = quantized;
             